@@ -71,12 +71,26 @@
 #define configUSE_PREEMPTION		1
 //MODIFIED by Julien Deantoni --> no idle hook function required
 #define configUSE_IDLE_HOOK			0                             
-#define configUSE_TICK_HOOK			0
+#define configUSE_TICK_HOOK			1 // Timebase (drivers/timebase)
+#define configUSE_MALLOC_FAILED_HOOK	1 // main.cpp
+#define configCHECK_FOR_STACK_OVERFLOW	2 // main.cpp, checked on each context switch
 #define configCPU_CLOCK_HZ			( ( unsigned long ) F_CPU )
 #define configTICK_RATE_HZ			( ( portTickType ) 1000 )
 #define configMAX_PRIORITIES		( 4 )
 #define configMINIMAL_STACK_SIZE	( ( unsigned short ) 85 )
-#define configTOTAL_HEAP_SIZE		( (size_t ) ( 1500 ) )
+/* heap_1: the tasks, queues and semaphores created before the scheduler
+   starts, never freed. .data + .bss (`make size`), this heap and the
+   stack of main() until the scheduler starts share the 2KB of RAM: the
+   heap is kept to what the objects need plus a margin, not the rest of
+   the RAM. Counted by hand from the FreeRTOS structures (TCB 40 bytes,
+   queue 30 + items, stream buffer 16 + storage), not measured:
+     idle      40 + 85              rfid       40 + 185
+     i2c_cmd   40 + 205             ultrasonic 40 + 135 (or lcd_bench)
+     command queue  30 + 8 x 2      tag message buffer  16 + 25
+     EEPROM mutex   30              button semaphore    30
+   917 bytes. REG_HEAP_FREE and REG_STACK_MARGIN publish what is left at
+   run time, and the hooks below halt on an exhausted heap or stack. */
+#define configTOTAL_HEAP_SIZE		( (size_t ) ( 1000 ) )
 #define configMAX_TASK_NAME_LEN		( 8 )
 #define configUSE_TRACE_FACILITY	0
 #define configUSE_16_BIT_TICKS		1
@@ -104,6 +118,9 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend			1
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_uxTaskGetStackHighWaterMark	1
+#define INCLUDE_xTaskGetIdleTaskHandle	1
+#define INCLUDE_xTaskGetSchedulerState	1
 
 
 #endif /* FREERTOS_CONFIG_H */
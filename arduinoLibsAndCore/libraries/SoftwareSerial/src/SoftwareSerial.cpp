@@ -224,6 +224,15 @@ inline void SoftwareSerial::handle_interrupt()
   }
 }
 
+#if defined(SOFTWARESERIAL_SHARED_PCINT)
+// The pin change vectors are owned by the application, which calls this
+// from its own handler
+void SoftwareSerial_handlePinChange()
+{
+  SoftwareSerial::handle_interrupt();
+}
+#else
+
 #if defined(PCINT0_vect)
 ISR(PCINT0_vect)
 {
@@ -243,6 +252,8 @@ ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
 ISR(PCINT3_vect, ISR_ALIASOF(PCINT0_vect));
 #endif
 
+#endif // SOFTWARESERIAL_SHARED_PCINT
+
 //
 // Constructor
 //
@@ -111,4 +111,9 @@ public:
   static inline void handle_interrupt() __attribute__((__always_inline__));
 };
 
+#if defined(SOFTWARESERIAL_SHARED_PCINT)
+// Receive handler, to be called on pin changes of the RX pin bank
+void SoftwareSerial_handlePinChange();
+#endif
+
 #endif
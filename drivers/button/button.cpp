@@ -1,4 +1,5 @@
 #include "button.h"
+#include "../timebase/timebase.h"
 #include <avr/interrupt.h>
 
 // Pointeurs globaux pour retrouver nos objets Bouton depuis les interruptions
@@ -37,8 +38,8 @@ bool Button::waitForPress(TickType_t timeout) {
 
 void Button::_isrHandler() {
     // Anti-rebond simple (200ms)
-    TickType_t now = xTaskGetTickCountFromISR();
-    if ((now - _lastPressTime) > pdMS_TO_TICKS(200)) {
+    uint32_t now = Timebase::millis();
+    if ((now - _lastPressTime) > 200) {
         _lastPressTime = now;
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
         xSemaphoreGiveFromISR(_semaphore, &xHigherPriorityTaskWoken);
@@ -22,7 +22,7 @@ public:
 private:
     uint8_t _pin;
     SemaphoreHandle_t _semaphore;
-    volatile TickType_t _lastPressTime;
+    volatile uint32_t _lastPressTime;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include "eeprom_lock.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+static SemaphoreHandle_t g_mutex = NULL;
+
+void EepromLock::init()
+{
+    if (g_mutex == NULL)
+        g_mutex = xSemaphoreCreateMutex();
+}
+
+void EepromLock::take()
+{
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+}
+
+void EepromLock::give()
+{
+    xSemaphoreGive(g_mutex);
+}
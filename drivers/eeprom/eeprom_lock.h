@@ -0,0 +1,26 @@
+#ifndef EEPROM_LOCK_H
+#define EEPROM_LOCK_H
+
+/*
+ * Serializes the EEPROM accesses of the tasks. avr-libc loads the address
+ * and data registers before it disables the interrupts to strobe a write:
+ * a task switched out in between, whose successor touches the EEPROM,
+ * writes its byte to the other task's address. Every EEPROM access made
+ * once the scheduler runs goes between take() and give(); a mutex rather
+ * than a suspended scheduler, as a write holds it ~3.4ms per byte.
+ */
+class EepromLock {
+public:
+    /**
+     * Create the mutex, before the scheduler starts
+     */
+    static void init();
+
+    /**
+     * Wait for the EEPROM, then give() it back
+     */
+    static void take();
+    static void give();
+};
+
+#endif // EEPROM_LOCK_H
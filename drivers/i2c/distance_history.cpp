@@ -0,0 +1,192 @@
+#include "distance_history.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if DISTANCE_HISTORY_SIZE > 255
+#error "DISTANCE_HISTORY_SIZE must fit the 8-bit count of the header"
+#endif
+
+// Ring of encoded samples; head is the first byte of the oldest sample
+static uint8_t g_ring[DISTANCE_HISTORY_SIZE];
+static volatile uint8_t g_head = 0;
+static volatile uint8_t g_count = 0;
+static volatile uint8_t g_lost = 0;
+
+// Reference of the oldest sample, and value of the newest one (as the
+// master will decode it, so rounding never accumulates)
+static uint32_t g_base_time = 0;
+static uint16_t g_base_distance = 0;
+static uint32_t g_last_time = 0;
+static uint16_t g_last_distance = 0;
+
+// Read in progress (TWI interrupt only, besides g_reading)
+static volatile uint8_t g_reading = 0;
+static uint8_t g_header[HISTORY_HEADER_SIZE];
+static uint8_t g_read_count = 0;     // Sample bytes in the stream
+static uint8_t g_read_pos = 0;       // Next stream byte, header included
+static uint8_t g_sample_start = 0;   // Stream offset of the sample being sent
+static uint8_t g_consumed = 0;       // Bytes of the samples sent whole
+static uint32_t g_read_time = 0;     // Reference after the samples sent whole
+static uint16_t g_read_distance = 0;
+
+static uint8_t ringAt(uint8_t offset)
+{
+    uint16_t index = (uint16_t)g_head + offset;
+    if (index >= DISTANCE_HISTORY_SIZE)
+        index -= DISTANCE_HISTORY_SIZE;
+    return g_ring[index];
+}
+
+static uint8_t sampleLength(uint8_t first)
+{
+    return (first & HISTORY_LONG_FLAG) ? 4 : 2;
+}
+
+// Move a reference past the sample at a ring offset
+static void decode(uint8_t offset, uint32_t *time, uint16_t *distance)
+{
+    uint8_t first = ringAt(offset);
+    uint8_t second = ringAt(offset + 1);
+    if (first & HISTORY_LONG_FLAG)
+    {
+        *time += ((uint16_t)(first & ~HISTORY_LONG_FLAG) << 8) | second;
+        *distance = ((uint16_t)ringAt(offset + 2) << 8) | ringAt(offset + 3);
+    }
+    else
+    {
+        *time += (uint16_t)first * 4;
+        *distance += (int8_t)second;
+    }
+}
+
+void DistanceHistory::evictOldest()
+{
+    uint8_t len = sampleLength(ringAt(0));
+    decode(0, &g_base_time, &g_base_distance);
+    uint16_t head = (uint16_t)g_head + len;
+    g_head = head >= DISTANCE_HISTORY_SIZE ? head - DISTANCE_HISTORY_SIZE : head;
+    g_count -= len;
+}
+
+void DistanceHistory::append(const uint8_t *bytes, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++)
+    {
+        uint16_t index = (uint16_t)g_head + g_count;
+        if (index >= DISTANCE_HISTORY_SIZE)
+            index -= DISTANCE_HISTORY_SIZE;
+        g_ring[index] = bytes[i];
+        g_count++;
+    }
+}
+
+void DistanceHistory::push(uint32_t timestamp_ms, uint16_t distance_mm)
+{
+    portENTER_CRITICAL();
+    if (g_count == 0 && !g_reading)
+    {
+        // Empty: the sample becomes the reference
+        g_base_time = g_last_time = timestamp_ms;
+        g_base_distance = g_last_distance = distance_mm;
+    }
+
+    uint8_t bytes[4];
+    uint8_t len;
+    uint32_t elapsed = timestamp_ms - g_last_time;
+    int16_t delta = (int16_t)(distance_mm - g_last_distance);
+    uint32_t units = (elapsed + 2) / 4;
+    if (units <= 0x7F && delta >= -128 && delta <= 127)
+    {
+        bytes[0] = units;
+        bytes[1] = (uint8_t)delta;
+        len = 2;
+        elapsed = units * 4;
+    }
+    else
+    {
+        if (elapsed > 0x7FFF)
+            elapsed = 0x7FFF; // Sampling paused: the trace shifts
+        bytes[0] = HISTORY_LONG_FLAG | (elapsed >> 8);
+        bytes[1] = elapsed & 0xFF;
+        bytes[2] = distance_mm >> 8;
+        bytes[3] = distance_mm & 0xFF;
+        len = 4;
+    }
+
+    // Make room, unless the master is reading the oldest samples
+    while (!g_reading && DISTANCE_HISTORY_SIZE - g_count < len)
+        evictOldest();
+
+    if (DISTANCE_HISTORY_SIZE - g_count >= len)
+    {
+        append(bytes, len);
+        g_last_time += elapsed;
+        g_last_distance = distance_mm;
+    }
+    else if (g_lost < 0xFF)
+        g_lost++;
+    portEXIT_CRITICAL();
+}
+
+void DistanceHistory::beginRead()
+{
+    g_reading = 1;
+    g_read_count = g_count;
+    g_read_pos = 0;
+    g_sample_start = 0;
+    g_consumed = 0;
+    g_read_time = g_base_time;
+    g_read_distance = g_base_distance;
+
+    g_header[0] = g_read_count;
+    g_header[1] = g_lost;
+    g_header[2] = g_base_time >> 24;
+    g_header[3] = g_base_time >> 16;
+    g_header[4] = g_base_time >> 8;
+    g_header[5] = g_base_time & 0xFF;
+    g_header[6] = g_base_distance >> 8;
+    g_header[7] = g_base_distance & 0xFF;
+}
+
+uint8_t DistanceHistory::readByte()
+{
+    if (g_read_pos < HISTORY_HEADER_SIZE)
+        return g_header[g_read_pos++];
+
+    uint8_t offset = g_read_pos - HISTORY_HEADER_SIZE;
+    if (offset >= g_read_count)
+        return 0x00; // Padding after the last sample
+    g_read_pos++;
+    return ringAt(offset);
+}
+
+void DistanceHistory::byteSent()
+{
+    if (g_read_pos <= HISTORY_HEADER_SIZE)
+        return;
+
+    // Last byte of a sample: it will be dropped at the end of the read
+    uint8_t sent = g_read_pos - HISTORY_HEADER_SIZE;
+    if (sent - g_sample_start == sampleLength(ringAt(g_sample_start)))
+    {
+        decode(g_sample_start, &g_read_time, &g_read_distance);
+        g_consumed = sent;
+        g_sample_start = sent;
+    }
+}
+
+void DistanceHistory::endRead()
+{
+    if (g_read_pos >= 2)
+        g_lost -= g_header[1]; // Reported to the master
+
+    if (g_consumed > 0)
+    {
+        uint16_t head = (uint16_t)g_head + g_consumed;
+        g_head = head >= DISTANCE_HISTORY_SIZE ? head - DISTANCE_HISTORY_SIZE : head;
+        g_count -= g_consumed;
+        g_base_time = g_read_time;
+        g_base_distance = g_read_distance;
+    }
+    g_reading = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef DISTANCE_HISTORY_H
+#define DISTANCE_HISTORY_H
+
+#include <inttypes.h>
+
+// Bytes of encoded samples kept on chip: ~2 bytes per sample, so 64 bytes
+// hold about 2s at the fastest sampling period, twice the read interval
+// of raspberry_i2c_history.py
+#ifndef DISTANCE_HISTORY_SIZE
+#define DISTANCE_HISTORY_SIZE 64
+#endif
+
+// Header sent before the samples: sample bytes that follow, samples lost
+// since the last read, time (ms, 32 bits) and distance (mm, 16 bits) the
+// first sample is relative to. Big-endian
+#define HISTORY_HEADER_SIZE 8
+
+// Encoded samples, relative to the previous one (the header for the first):
+//   short, 2 bytes: 0ttttttt dddddddd  time + t * 4ms, distance + (int8_t)d
+//   long,  4 bytes: 1ttttttt tttttttt  time + t ms (15 bits),
+//                   dddddddd dddddddd  distance (absolute)
+#define HISTORY_LONG_FLAG 0x80
+
+/*
+ * Raw distance samples of one ranger, delta-encoded in a byte ring so the
+ * master can capture a full-rate trace without polling at the sensor rate.
+ *
+ * A read starting at REG_HISTORY streams the header then every sample,
+ * zeros after the last; the samples sent whole are dropped when the read
+ * ends. While a read is in progress, nothing is evicted: samples that do
+ * not fit are counted as lost instead.
+ */
+class DistanceHistory {
+public:
+    /**
+     * Record a sample (task context)
+     * @param timestamp_ms Time of the measurement
+     * @param distance_mm Raw distance, 0 if no echo
+     */
+    static void push(uint32_t timestamp_ms, uint16_t distance_mm);
+
+    // Streaming to the master (TWI interrupt only)
+    static void beginRead();
+    static uint8_t readByte();
+    static void byteSent();
+    static void endRead();
+
+private:
+    static void append(const uint8_t *bytes, uint8_t len);
+    static void evictOldest();
+};
+
+#endif // DISTANCE_HISTORY_H
@@ -0,0 +1,65 @@
+#include "event_fifo.h"
+#include "i2c.h"
+#include "../timebase/timebase.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if (EVENT_FIFO_SIZE & (EVENT_FIFO_SIZE - 1)) || EVENT_FIFO_SIZE > 128
+#error "EVENT_FIFO_SIZE must be a power of two no larger than 128"
+#endif
+
+// Ring of records, stored in bus order; head is the next record to pop
+static uint8_t g_records[EVENT_FIFO_SIZE][EVENT_RECORD_SIZE];
+static volatile uint8_t g_head = 0;
+static volatile uint8_t g_count = 0;
+
+void EventFifo::push(uint8_t type, uint8_t data)
+{
+    pushRecord(type, data, Timebase::millis());
+}
+
+void EventFifo::pushFromISR(uint8_t type, uint8_t data)
+{
+    pushRecord(type, data, Timebase::millis());
+}
+
+void EventFifo::pushRecord(uint8_t type, uint8_t data, uint16_t timestamp)
+{
+    portENTER_CRITICAL();
+    if (g_count < EVENT_FIFO_SIZE)
+    {
+        uint8_t *record = g_records[(g_head + g_count) & (EVENT_FIFO_SIZE - 1)];
+        record[0] = type;
+        record[1] = data;
+        record[2] = timestamp >> 8;
+        record[3] = timestamp & 0xFF;
+        g_count++;
+        I2C_Protocol::set<REG_EVENT_COUNT>(g_count);
+    }
+    else
+    {
+        // Saturating counter, cleared by the master writing 0
+        uint8_t lost = I2C_Protocol::get<REG_EVENT_OVERFLOW>();
+        if (lost < 0xFF)
+            I2C_Protocol::set<REG_EVENT_OVERFLOW>(lost + 1);
+    }
+    portEXIT_CRITICAL();
+}
+
+const uint8_t *EventFifo::front()
+{
+    // The head record is never touched by push()
+    return g_count > 0 ? g_records[g_head] : NULL;
+}
+
+void EventFifo::drop()
+{
+    portENTER_CRITICAL();
+    if (g_count > 0)
+    {
+        g_head = (g_head + 1) & (EVENT_FIFO_SIZE - 1);
+        g_count--;
+        I2C_Protocol::set<REG_EVENT_COUNT>(g_count);
+    }
+    portEXIT_CRITICAL();
+}
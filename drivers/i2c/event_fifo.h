@@ -0,0 +1,54 @@
+#ifndef EVENT_FIFO_H
+#define EVENT_FIFO_H
+
+#include <inttypes.h>
+
+// Number of records kept on chip (power of two)
+#ifndef EVENT_FIFO_SIZE
+#define EVENT_FIFO_SIZE 16
+#endif
+
+// Size of a record on the bus: type, data, timestamp (MSB), timestamp (LSB)
+#define EVENT_RECORD_SIZE 4
+
+// Event types
+#define EVENT_NONE          0x00  // Empty record, marks the end of a burst
+#define EVENT_MOTION_START  0x01  // Motion detected (data = ultrasonic sensor index)
+#define EVENT_MOTION_STOP   0x02  // Motion ended (data = ultrasonic sensor index)
+#define EVENT_TAG_READ      0x03  // RFID tag read (data = XOR of the ID bytes)
+#define EVENT_BUTTON_PRESS  0x04  // Button pressed (data unused)
+#define EVENT_ALARM_CHANGE  0x05  // Alarm state changed (data = new state)
+#define EVENT_PRESENCE      0x06  // Presence changed (data = REG_PRESENCE)
+
+class EventFifo {
+public:
+    /**
+     * Record an event, timestamped with Timebase::millis().
+     * When the FIFO is full the event is dropped and REG_EVENT_OVERFLOW
+     * is incremented.
+     * @param type Event type (EVENT_*)
+     * @param data Event specific payload
+     */
+    static void push(uint8_t type, uint8_t data = 0);
+
+    /**
+     * Same as push(), for use inside an interrupt handler
+     */
+    static void pushFromISR(uint8_t type, uint8_t data = 0);
+
+    /**
+     * Oldest event, read in place by the TWI interrupt
+     * @return The EVENT_RECORD_SIZE bytes of the record, NULL if empty
+     */
+    static const uint8_t *front();
+
+    /**
+     * Remove the oldest event, once it has been sent
+     */
+    static void drop();
+
+private:
+    static void pushRecord(uint8_t type, uint8_t data, uint16_t timestamp);
+};
+
+#endif // EVENT_FIFO_H
@@ -1,36 +1,322 @@
 #include "i2c.h"
+#include "event_fifo.h"
+#include "distance_history.h"
+#include "twi_slave.h"
 #include <string.h>
+#include <util/crc16.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
 
 // Global variables for the protocol
-static volatile uint8_t g_registers[I2C_NUM_REGISTERS];
+// Double-buffered register bank: the TWI handlers always serve the committed
+// bank g_banks[g_active], updates are staged in the other one and published
+// by flipping g_active (a single byte store, hence atomic for the ISR)
+static volatile uint8_t g_banks[2][I2C_NUM_REGISTERS];
+static volatile uint8_t g_active = 0;
+static volatile uint8_t g_updating = 0;
 static volatile uint8_t g_register_pointer = 0;
 static volatile I2CCallback g_register_callback;
+static volatile I2CDataCallback g_data_callback;
+// Registers changed by the firmware since the master last read them
+static volatile uint8_t g_dirty[I2C_DIRTY_BYTES];
+// Registers the master may write (I2C_RW), same layout as the bitmap
+static uint8_t g_writable[I2C_DIRTY_BYTES];
+
+// State of the transaction in progress (TWI interrupt only)
+static uint8_t g_expect_pointer = 0;     // Next written byte is the pointer
+static uint8_t g_read_index = 0;         // Next register served to the master
+static uint8_t g_read_fifo = 0;          // Read started at REG_EVENT_FIFO (2: padding)
+static uint8_t g_fifo_offset = 0;        // Byte of the record being sent
+static uint8_t g_read_history = 0;       // Read started at REG_HISTORY
+static volatile uint8_t g_read_bank = 0xFF; // Bank being read, 0xFF if none
+
+// Command frames (REG_MAILBOX), received in the slot following the pending
+// ones and handled in order
+typedef struct
+{
+    uint8_t len;
+    uint8_t bytes[i2cRegisterWidth(REG_MAILBOX)];
+} I2CFrame;
+
+static I2CFrame g_frames[I2C_FRAME_SLOTS];
+static volatile uint8_t g_frame_head = 0;  // Oldest pending frame
+static volatile uint8_t g_frame_count = 0; // Frames pending
+
+#define FRAME_NONE      0
+#define FRAME_RECEIVING 1
+#define FRAME_DROPPED   2
+static uint8_t g_frame_state = FRAME_NONE; // Frame of the write in progress (TWI interrupt only)
+static uint8_t g_frame_slot = 0;
+static uint8_t g_frame_seq = 0;
+
+#if I2C_COMMAND_QUEUE
+// Master write waiting for the command task
+typedef struct
+{
+    uint8_t reg;
+    uint8_t value;
+} I2CCommand;
+
+static QueueHandle_t g_command_queue = NULL;
+static TaskHandle_t g_command_task = NULL;
+#endif
+
+#define COMMITTED_BANK g_banks[g_active]
+#define STAGING_BANK g_banks[g_active ^ 1]
+
+// Store a value in the committed bank, mirroring it in the staging bank while
+// an update is open so that the commit does not roll it back
+static void storeRegister(uint8_t reg, uint8_t value)
+{
+    COMMITTED_BANK[reg] = value;
+    if (g_updating)
+        STAGING_BANK[reg] = value;
+}
+
+static void markDirty(uint8_t reg)
+{
+    g_dirty[reg >> 3] |= _BV(reg & 7);
+}
+
+static void markWritable(uint8_t offset, uint8_t width)
+{
+    for (uint8_t reg = offset; reg < offset + width; reg++)
+        g_writable[reg >> 3] |= _BV(reg & 7);
+}
+
+static uint8_t isWritable(uint8_t reg)
+{
+    return reg < I2C_NUM_REGISTERS && (g_writable[reg >> 3] & _BV(reg & 7));
+}
+
+// Bitmap bits that raise the attention line: the FIFO bookkeeping has its
+// own source, and the bitmap itself is never flagged
+static uint8_t changesPending()
+{
+    for (uint8_t i = 0; i < I2C_DIRTY_BYTES; i++)
+    {
+        uint8_t bits = g_dirty[i];
+        if (i == (REG_EVENT_COUNT >> 3))
+            bits &= ~_BV(REG_EVENT_COUNT & 7);
+        if (i == (REG_EVENT_OVERFLOW >> 3))
+            bits &= ~_BV(REG_EVENT_OVERFLOW & 7);
+        if (bits)
+            return 1;
+    }
+    return 0;
+}
+
+static void acknowledgeFrame(uint8_t seq, uint8_t status)
+{
+    if (status != CMD_OK)
+        I2C_Protocol::set<REG_CMD_NACK>((seq << 8) | status);
+    I2C_Protocol::set<REG_CMD_ACK>((seq << 8) | status);
+}
+
+// Check a data frame, then hand its payload over
+static uint8_t handleDataFrame(const I2CFrame *frame)
+{
+    const uint8_t *bytes = frame->bytes;
+    uint8_t len = bytes[1] & ~CMD_FRAME_DATA;
+
+    if (len == 0 || len > CMD_FRAME_MAX_DATA || frame->len < 4 + len)
+        return CMD_BAD_LENGTH;
+
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < 3 + len; i++)
+        crc = _crc8_ccitt_update(crc, bytes[i]);
+    if (crc != bytes[3 + len])
+        return CMD_BAD_CRC;
+
+#if !I2C_COMMAND_QUEUE
+    // Inside the TWI interrupt: payloads may take milliseconds to apply
+    // (EEPROM writes), with every interrupt held off
+    return CMD_DENIED;
+#else
+    I2CDataCallback callback = g_data_callback;
+    return callback != NULL ? callback(bytes[2], &bytes[3], len) : CMD_DENIED;
+#endif
+}
+
+// Check a whole frame, then run its operations
+static void handleFrame(const I2CFrame *frame)
+{
+    const uint8_t *bytes = frame->bytes;
+    uint8_t count = bytes[1];
+    uint8_t status = CMD_OK;
+
+    if (frame->len >= 2 && (count & CMD_FRAME_DATA))
+    {
+        acknowledgeFrame(bytes[0], handleDataFrame(frame));
+        return;
+    }
+
+    if (frame->len < 3 || count == 0 || count > CMD_FRAME_MAX_OPS || frame->len < 3 + 2 * count)
+        status = CMD_BAD_LENGTH;
+    else
+    {
+        uint8_t crc = 0;
+        for (uint8_t i = 0; i < 2 + 2 * count; i++)
+            crc = _crc8_ccitt_update(crc, bytes[i]);
+        if (crc != bytes[2 + 2 * count])
+            status = CMD_BAD_CRC;
+        for (uint8_t i = 0; status == CMD_OK && i < count; i++)
+        {
+            if (!isWritable(bytes[2 + 2 * i]))
+                status = CMD_DENIED;
+        }
+    }
+
+    for (uint8_t i = 0; status == CMD_OK && i < count; i++)
+    {
+        uint8_t reg = bytes[2 + 2 * i];
+        uint8_t value = bytes[3 + 2 * i];
+
+        // Same as a direct write of the register
+        portENTER_CRITICAL();
+        storeRegister(reg, value);
+        portEXIT_CRITICAL();
+
+        I2CCallback callback = g_register_callback;
+        if (callback != NULL)
+            callback(reg, value);
+    }
+
+    acknowledgeFrame(bytes[0], status);
+}
 
 void I2C_Protocol::init(uint8_t slave_address)
 {
     // Initialize registers to zero
-    memset((void *)g_registers, 0, I2C_NUM_REGISTERS);
-    memset((void *)g_register_callback, 0, sizeof(g_register_callback));
+    memset((void *)g_banks, 0, sizeof(g_banks));
+    memset((void *)g_dirty, 0, sizeof(g_dirty));
+    g_register_callback = NULL;
+    g_data_callback = NULL;
+#define I2C_REGISTER_WRITABLE(name, offset, width, access, description) \
+    if ((access) == I2C_RW)                                             \
+        markWritable(offset, width);
+    memset(g_writable, 0, sizeof(g_writable));
+    I2C_REGISTER_TABLE(I2C_REGISTER_WRITABLE)
+#undef I2C_REGISTER_WRITABLE
+    g_banks[0][REG_ATTN_CONFIG] = g_banks[1][REG_ATTN_CONFIG] = ATTN_ON_EVENTS | ATTN_ON_CHANGES;
 
-    // Initialize Wire in slave mode with the specified address
-    Wire.begin(slave_address);
+    // Attention line released (input, no pull-up)
+    I2C_ATTN_PORT &= ~_BV(I2C_ATTN_BIT);
+    I2C_ATTN_DDR &= ~_BV(I2C_ATTN_BIT);
 
-    // Register Wire callbacks for receive and request events
-    Wire.onReceive(onReceiveHandler);
-    Wire.onRequest(onRequestHandler);
+#if I2C_COMMAND_QUEUE
+    if (g_command_queue == NULL)
+    {
+        g_command_queue = xQueueCreate(I2C_COMMAND_QUEUE_LENGTH, sizeof(I2CCommand));
+        xTaskCreate(commandTask, "i2c_cmd", I2C_COMMAND_TASK_STACK, NULL, I2C_COMMAND_TASK_PRIORITY, &g_command_task);
+    }
+#endif
+
+    // Serve the bank from the TWI interrupt
+    TWI_Slave::init(slave_address);
+}
+
+void I2C_Protocol::writeRegisters(uint8_t offset, const uint8_t *bytes, uint8_t len)
+{
+    uint8_t changed = 0;
+
+    portENTER_CRITICAL();
+    for (uint8_t i = 0; i < len; i++)
+    {
+        uint8_t reg = offset + i;
+        if (g_updating)
+            STAGING_BANK[reg] = bytes[i]; // Published (and flagged) by commitUpdate()
+        else if (COMMITTED_BANK[reg] != bytes[i])
+        {
+            storeRegister(reg, bytes[i]);
+            markDirty(reg);
+            changed = 1;
+        }
+    }
+    if (changed)
+        updateAttention();
+    portEXIT_CRITICAL();
+}
+
+void I2C_Protocol::readRegisters(uint8_t offset, uint8_t *bytes, uint8_t len)
+{
+    // The updating task sees its own staged values
+    portENTER_CRITICAL();
+    volatile uint8_t *bank = g_updating ? STAGING_BANK : COMMITTED_BANK;
+    for (uint8_t i = 0; i < len; i++)
+        bytes[i] = bank[offset + i];
+    portEXIT_CRITICAL();
 }
 
 void I2C_Protocol::setRegister(uint8_t reg, uint8_t value)
 {
     if (reg < I2C_NUM_REGISTERS)
-        g_registers[reg] = value;
+        writeRegisters(reg, &value, 1);
 }
 
 uint8_t I2C_Protocol::getRegister(uint8_t reg)
 {
-    if (reg < I2C_NUM_REGISTERS)
-        return g_registers[reg];
-    return 0;
+    if (reg >= I2C_NUM_REGISTERS)
+        return 0;
+
+    return g_updating ? STAGING_BANK[reg] : COMMITTED_BANK[reg];
+}
+
+void I2C_Protocol::beginUpdate()
+{
+    // No other task may touch the registers until the commit. A read that
+    // began before the last commit may still stream the bank that is about
+    // to be staged into: let it finish rather than tear it
+    vTaskSuspendAll();
+    while (g_read_bank == (g_active ^ 1))
+    {
+        xTaskResumeAll();
+        vTaskDelay(1);
+        vTaskSuspendAll();
+    }
+
+    // Copy with the TWI interrupt held off (~30us): a master write landing
+    // between the load and the store of a byte would be overwritten in the
+    // staging bank, then rolled back by the commit. From here on, master
+    // writes go to both banks
+    portENTER_CRITICAL();
+    for (uint8_t i = 0; i < I2C_NUM_REGISTERS; i++)
+        STAGING_BANK[i] = COMMITTED_BANK[i];
+    g_updating = 1;
+    portEXIT_CRITICAL();
+}
+
+void I2C_Protocol::commitUpdate()
+{
+    // Flag what the update changes. Master writes go to both banks, so they
+    // never show up here
+    portENTER_CRITICAL();
+    for (uint8_t i = 0; i < REG_DIRTY; i++)
+    {
+        if (STAGING_BANK[i] != COMMITTED_BANK[i])
+            markDirty(i);
+    }
+
+    // Publish the staged bank: the ISR sees either the old or the new one
+    g_active ^= 1;
+    g_updating = 0;
+
+    updateAttention();
+    portEXIT_CRITICAL();
+
+    xTaskResumeAll();
+}
+
+void I2C_Protocol::updateAttention()
+{
+    uint8_t config = COMMITTED_BANK[REG_ATTN_CONFIG];
+
+    if (((config & ATTN_ON_EVENTS) && COMMITTED_BANK[REG_EVENT_COUNT]) ||
+        ((config & ATTN_ON_CHANGES) && changesPending()))
+        I2C_ATTN_DDR |= _BV(I2C_ATTN_BIT); // Drive low
+    else
+        I2C_ATTN_DDR &= ~_BV(I2C_ATTN_BIT); // Release
 }
 
 void I2C_Protocol::registerCallback(I2CCallback callback)
@@ -38,45 +324,209 @@ void I2C_Protocol::registerCallback(I2CCallback callback)
     g_register_callback = callback;
 }
 
-// Handler called when the Master (Raspberry Pi) writes data
-void I2C_Protocol::onReceiveHandler(int numBytes)
+void I2C_Protocol::registerDataCallback(I2CDataCallback callback)
 {
-    if (numBytes < 1)
-        return;
+    g_data_callback = callback;
+}
 
-    // Read register address (first byte)
-    g_register_pointer = Wire.read();
-    numBytes--;
+uint8_t I2C_Protocol::commandStackMargin()
+{
+#if I2C_COMMAND_QUEUE
+    if (g_command_task != NULL)
+        return uxTaskGetStackHighWaterMark(g_command_task);
+#endif
+    return 0xFF;
+}
 
-    // Read data to write into consecutive registers
-    while (numBytes > 0 && Wire.available())
+#if I2C_COMMAND_QUEUE
+void I2C_Protocol::commandTask(void *pvParameters)
+{
+    I2CCommand command;
+
+    while (1)
     {
-        if (g_register_pointer < I2C_NUM_REGISTERS)
+        // Sleep until the master writes, then handle everything queued
+        xQueueReceive(g_command_queue, &command, portMAX_DELAY);
+        do
         {
-            uint8_t value = Wire.read();
-            g_registers[g_register_pointer] = value;
+            if (command.reg == REG_MAILBOX)
+            {
+                // Oldest pending frame, then free its slot
+                handleFrame(&g_frames[g_frame_head]);
+                portENTER_CRITICAL();
+                g_frame_head = (g_frame_head + 1) % I2C_FRAME_SLOTS;
+                g_frame_count--;
+                portEXIT_CRITICAL();
+                continue;
+            }
+
+            I2CCallback callback = g_register_callback;
+            if (callback != NULL)
+                callback(command.reg, command.value);
+        } while (xQueueReceive(g_command_queue, &command, 0) == pdTRUE);
+    }
+}
+#endif
+
+// ========== TWI slave hooks (interrupt context) ==========
+
+void I2C_Protocol::_onWriteBegin()
+{
+    g_expect_pointer = 1;
+    g_frame_state = FRAME_NONE; // A frame cut by a bus error is dropped
+}
 
-            // Call the callback if defined
-            if (g_register_callback != NULL)
-                g_register_callback(g_register_pointer, value);
+// Byte written by the Master (Raspberry Pi)
+void I2C_Protocol::_onWriteByte(uint8_t data)
+{
+    if (g_expect_pointer)
+    {
+        // Register address (first byte)
+        g_register_pointer = data;
+        g_expect_pointer = 0;
+        return;
+    }
+
+    // Data to write into consecutive registers, dropped past the bank and
+    // on the registers the master may not write
+    uint8_t reg = g_register_pointer;
+    if (reg >= I2C_NUM_REGISTERS)
+        return;
+    g_register_pointer++;
 
-            g_register_pointer++;
+    uint8_t offset = reg - REG_MAILBOX;
+    if (offset < i2cRegisterWidth(REG_MAILBOX))
+    {
+        // Command frame byte: a slot is picked (or not) by the first one
+        if (g_frame_state == FRAME_NONE)
+        {
+            g_frame_state = FRAME_DROPPED;
+            if (g_frame_count < I2C_FRAME_SLOTS)
+            {
+                g_frame_state = FRAME_RECEIVING;
+                g_frame_slot = (g_frame_head + g_frame_count) % I2C_FRAME_SLOTS;
+                g_frames[g_frame_slot].len = 0;
+            }
+        }
+        if (offset == 0)
+            g_frame_seq = data;
+        if (g_frame_state == FRAME_RECEIVING)
+        {
+            I2CFrame *frame = &g_frames[g_frame_slot];
+            frame->bytes[offset] = data;
+            if (offset >= frame->len)
+                frame->len = offset + 1;
         }
+        return;
+    }
+
+    if (!isWritable(reg))
+        return;
+
+    storeRegister(reg, data);
+
+#if I2C_COMMAND_QUEUE
+    // Hand the write over to the command task, which is picked up on the
+    // next tick at the latest
+    I2CCommand command = {reg, data};
+    if (xQueueSendFromISR(g_command_queue, &command, NULL) != pdTRUE)
+        storeRegister(REG_ERROR_CODE, ERR_COMMAND_LOST);
+#else
+    // Call the callback if defined
+    if (g_register_callback != NULL)
+        g_register_callback(reg, data);
+#endif
+}
+
+void I2C_Protocol::_onWriteEnd()
+{
+    if (g_frame_state == FRAME_RECEIVING)
+    {
+#if I2C_COMMAND_QUEUE
+        // The slot stays taken until the command task has handled it
+        I2CCommand command = {REG_MAILBOX, 0};
+        if (xQueueSendFromISR(g_command_queue, &command, NULL) == pdTRUE)
+            g_frame_count++;
         else
-            Wire.read(); // Consume the byte even if it cannot be stored
-        numBytes--;
+            acknowledgeFrame(g_frame_seq, CMD_BUSY);
+#else
+        handleFrame(&g_frames[g_frame_slot]);
+#endif
+    }
+    else if (g_frame_state == FRAME_DROPPED)
+        acknowledgeFrame(g_frame_seq, CMD_BUSY);
+    g_frame_state = FRAME_NONE;
+
+    // REG_ATTN_CONFIG may have changed
+    updateAttention();
+}
+
+// The Master (Raspberry Pi) requests data
+void I2C_Protocol::_onReadBegin()
+{
+    g_read_bank = g_active;
+    g_read_index = g_register_pointer;
+    g_read_fifo = (g_register_pointer == REG_EVENT_FIFO);
+    g_fifo_offset = 0;
+    g_read_history = (g_register_pointer == REG_HISTORY);
+    if (g_read_history)
+        DistanceHistory::beginRead();
+}
+
+uint8_t I2C_Protocol::_onReadByte()
+{
+    if (g_read_history)
+        return DistanceHistory::readByte();
+
+    if (g_read_fifo)
+    {
+        // Once padding started, stay aligned on whole records until the end
+        const uint8_t *record = EventFifo::front();
+        if (g_read_fifo > 1 || record == NULL)
+        {
+            g_read_fifo = 2;
+            return EVENT_NONE;
+        }
+
+        return record[g_fifo_offset++];
+    }
+
+    if (g_read_index >= I2C_NUM_REGISTERS)
+        return 0x00; // Send 0 if out of range
+
+    uint8_t reg = g_read_index++;
+    if (reg < REG_DIRTY)
+        return g_banks[g_read_bank][reg];
+
+    // Bitmap byte: read and cleared at once, so no change is lost
+    uint8_t bits = g_dirty[reg - REG_DIRTY];
+    g_dirty[reg - REG_DIRTY] = 0;
+    return bits;
+}
+
+void I2C_Protocol::_onReadByteSent()
+{
+    if (g_read_history)
+        DistanceHistory::byteSent();
+    else if (g_read_fifo == 1 && g_fifo_offset == EVENT_RECORD_SIZE)
+    {
+        // Last byte of the record went out: it can be dropped
+        EventFifo::drop();
+        g_fifo_offset = 0;
     }
 }
 
-// Handler called when the Master (Raspberry Pi) requests data
-void I2C_Protocol::onRequestHandler()
+void I2C_Protocol::_onReadEnd()
 {
-    // Send the value of the pointed register
-    if (g_register_pointer < I2C_NUM_REGISTERS)
+    g_read_bank = 0xFF;
+    g_read_fifo = 0;
+    if (g_read_history)
     {
-        Wire.write(g_registers[g_register_pointer]);
-        g_register_pointer++;
+        // The samples sent whole are dropped
+        DistanceHistory::endRead();
+        g_read_history = 0;
     }
-    else
-        Wire.write(0x00); // Send 0 if out of range
+
+    // The bitmap or the FIFO may have been drained
+    updateAttention();
 }
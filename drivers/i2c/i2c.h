@@ -1,73 +1,249 @@
 #ifndef I2C_PROTOCOL_H
 #define I2C_PROTOCOL_H
 
-#include <Wire.h>
-
-// Definition of protocol registers
-#define I2C_NUM_REGISTERS 32
-
-// Register map (customize as needed)
-#define REG_STATUS          0x00  // General system status
-#define REG_ALARM_STATE     0x01  // Alarm state (0=off, 1=on)
-#define REG_MOTION_DETECTED 0x02  // Motion detected (0=no, 1=yes)
-#define REG_BUZZER_CMD      0x03  // Buzzer command (0=off, 1=on)
-#define REG_LED_CMD         0x04  // LED command (0=off, 1=on)
-#define REG_DISTANCE_H      0x05  // Ultrasonic sensor distance (MSB)
-#define REG_DISTANCE_L      0x06  // Ultrasonic sensor distance (LSB)
-#define REG_RFID_STATUS     0x07  // RFID status (0=no tag, 1=tag present)
-#define REG_RFID_ID_0       0x08  // RFID ID byte 0
-#define REG_RFID_ID_1       0x09  // RFID ID byte 1
-#define REG_RFID_ID_2       0x0A  // RFID ID byte 2
-#define REG_RFID_ID_3       0x0B  // RFID ID byte 3
-#define REG_RFID_ID_4       0x0C  // RFID ID byte 4
-#define REG_RFID_ID_5       0x0D  // RFID ID byte 5
-#define REG_ROTARY_ANGLE    0x10  // Potentiometer angle
-#define REG_BUTTON_STATE    0x11  // Button state (0=released, 1=pressed)
-#define REG_COMMAND         0x12  // General command register
-#define REG_ERROR_CODE      0x13  // Error code
+#include <avr/io.h>
+#include <inttypes.h>
+
+#include "i2c_registers.h"
+
+// REG_ATTN_CONFIG bits
+#define ATTN_ON_EVENTS      0x01  // Assert while the event FIFO is not empty
+#define ATTN_ON_CHANGES     0x02  // Assert while the changed-register bitmap is not empty
+
+// Attention line to the master: open-drain, active low. The line is only
+// ever driven low or released, so the Raspberry Pi pulls it up to its own
+// 3.3V and no 5V level reaches its GPIO. Default: D9 (PB1)
+#ifndef I2C_ATTN_DDR
+#define I2C_ATTN_DDR  DDRB
+#define I2C_ATTN_PORT PORTB
+#define I2C_ATTN_BIT  PB1
+#endif
+
+// REG_ERROR_CODE values
+#define ERR_NONE            0x00
+#define ERR_COMMAND_LOST    0x01  // Master write dropped, command queue full
+
+// Command frame, written by the master to REG_MAILBOX in one transaction:
+//   sequence number, operation count n,
+//   n x (register, value), CRC-8 (poly 0x07, init 0) of the bytes before
+// The operations target I2C_RW registers and run in order, as if written
+// one by one. The result lands in REG_CMD_ACK, and REG_CMD_NACK as well
+// when the frame is rejected as a whole
+#define CMD_FRAME_MAX_OPS   ((i2cRegisterWidth(REG_MAILBOX) - 3) / 2)
+
+// Data frame, same transaction: sequence number, CMD_FRAME_DATA | n,
+// target register, n payload bytes, CRC-8. The payload is handed whole
+// to the data callback (e.g. the badge allow-list sync), which returns
+// the frame status
+#define CMD_FRAME_DATA      0x80
+#define CMD_FRAME_MAX_DATA  (i2cRegisterWidth(REG_MAILBOX) - 4)
+
+// Frame status (LSB of REG_CMD_ACK/REG_CMD_NACK)
+#define CMD_OK              0x00
+#define CMD_BAD_LENGTH      0x01  // No operation, too many, or frame cut short
+#define CMD_BAD_CRC         0x02
+#define CMD_DENIED          0x03  // Operation on a register the master may not write, or data refused
+#define CMD_BUSY            0x04  // All frame slots in use, frame dropped
+
+// Frames received but not handled yet: this many can be in flight
+#ifndef I2C_FRAME_SLOTS
+#define I2C_FRAME_SLOTS 2
+#endif
+
+// Run the register callback from a dedicated task instead of the TWI ISR.
+// Set to 0 to call it inline (former behaviour, e.g. to compare ISR timings)
+#ifndef I2C_COMMAND_QUEUE
+#define I2C_COMMAND_QUEUE 1
+#endif
+
+#ifndef I2C_COMMAND_QUEUE_LENGTH
+#define I2C_COMMAND_QUEUE_LENGTH 8
+#endif
+
+#ifndef I2C_COMMAND_TASK_PRIORITY
+#define I2C_COMMAND_TASK_PRIORITY 2U
+#endif
+
+// Command task stack: a data frame runs the allow-list sync (frame check,
+// callback, EEPROM lock and writes) with the TWI interrupt on top
+#ifndef I2C_COMMAND_TASK_STACK
+#define I2C_COMMAND_TASK_STACK (configMINIMAL_STACK_SIZE + 120)
+#endif
 
 // Callback type for register changes
 typedef void (*I2CCallback)(uint8_t reg, uint8_t value);
 
+// Callback type for data frames, returns a CMD_* status
+typedef uint8_t (*I2CDataCallback)(uint8_t reg, const uint8_t *data, uint8_t len);
+
 class I2C_Protocol {
 public:
     /**
-     * Initialize the I2C protocol in slave mode with Wire
+     * Initialize the I2C protocol in slave mode (see twi_slave.h)
      * @param slave_address I2C address of the Arduino (0x32 by default)
      */
     static void init(uint8_t slave_address = 0x32);
     
     /**
-     * Set the value of a register
-     * @param reg Register number
+     * Set a register declared in I2C_REGISTER_TABLE, flagging the bytes
+     * that differ in the changed-register bitmap (REG_DIRTY). A multi-byte
+     * value is stored in one go; use beginUpdate() for the master to read
+     * it together with other registers.
+     * @param value Value to write, typed after the register width
+     */
+    template <I2CRegister Reg>
+    static void set(typename I2CRegisterType<i2cRegisterWidth(Reg)>::type value)
+    {
+        uint8_t bytes[sizeof(value)];
+        for (uint8_t i = sizeof(value); i-- > 0; value >>= 8)
+            bytes[i] = value;
+        writeRegisters(Reg, bytes, sizeof(value));
+    }
+
+    /**
+     * Read a register declared in I2C_REGISTER_TABLE
+     * @return Register value, typed after the register width
+     */
+    template <I2CRegister Reg>
+    static typename I2CRegisterType<i2cRegisterWidth(Reg)>::type get()
+    {
+        typename I2CRegisterType<i2cRegisterWidth(Reg)>::type value = 0;
+        uint8_t bytes[sizeof(value)];
+        readRegisters(Reg, bytes, sizeof(value));
+        for (uint8_t i = 0; i < sizeof(value); i++)
+            value = (value << 8) | bytes[i];
+        return value;
+    }
+
+    /**
+     * Byte-array registers (e.g. REG_RFID_ID): set/get the whole register
+     * @param bytes i2cRegisterWidth(Reg) bytes
+     */
+    template <I2CRegister Reg>
+    static void setBytes(const uint8_t *bytes)
+    {
+        static_assert(i2cRegisterWidth(Reg) > 0, "Not a register");
+        writeRegisters(Reg, bytes, i2cRegisterWidth(Reg));
+    }
+
+    template <I2CRegister Reg>
+    static void getBytes(uint8_t *bytes)
+    {
+        static_assert(i2cRegisterWidth(Reg) > 0, "Not a register");
+        readRegisters(Reg, bytes, i2cRegisterWidth(Reg));
+    }
+
+    /**
+     * Set the value of a register byte chosen at run time
+     * @param reg Register number, ignored if out of the bank
      * @param value Value to write
      */
     static void setRegister(uint8_t reg, uint8_t value);
     
     /**
-     * Read the value of a register
+     * Read the value of a register byte chosen at run time
      * @param reg Register number
-     * @return Register value
+     * @return Register value, 0 if out of the bank
      */
     static uint8_t getRegister(uint8_t reg);
+
+    /**
+     * Open an atomic update of several registers (e.g. the distance and
+     * the motion flag). Until commitUpdate(), writes are staged in a shadow bank
+     * while the master keeps reading the last committed one, so it never
+     * sees a half-written value. May wait for a master read of the shadow
+     * bank to end, then suspends the scheduler: the caller must not block
+     * until the commit, and updates cannot be nested.
+     */
+    static void beginUpdate();
+
+    /**
+     * Publish the registers staged since beginUpdate() in a single swap
+     */
+    static void commitUpdate();
     
     /**
-     * Register a callback called when a register is modified by the master
+     * Register a callback called when a register is modified by the master.
+     * With I2C_COMMAND_QUEUE the writes are queued by the ISR and the
+     * callback runs from the command task, in batches, so it may use any
+     * task-level API; otherwise it runs inside the TWI interrupt.
      * @param callback Function to call
      */
     static void registerCallback(I2CCallback callback);
 
+    /**
+     * Register a callback called with the payload of each data frame
+     * (CMD_FRAME_DATA), from the command task. Without one, or without
+     * I2C_COMMAND_QUEUE (the callback would block the TWI interrupt),
+     * data frames are denied
+     * @param callback Function to call
+     */
+    static void registerDataCallback(I2CDataCallback callback);
+
+    /**
+     * Stack the command task has never used so far, in bytes
+     * @return 0xFF without I2C_COMMAND_QUEUE
+     */
+    static uint8_t commandStackMargin();
+
 private:
     /**
-     * Wire handler called when the Master sends data
-     * @param numBytes Number of bytes received
+     * Store len bytes from offset on, no bounds check: callers are the
+     * typed accessors, whose offsets and widths come from the table
      */
-    static void onReceiveHandler(int numBytes);
-    
+    static void writeRegisters(uint8_t offset, const uint8_t *bytes, uint8_t len);
+    static void readRegisters(uint8_t offset, uint8_t *bytes, uint8_t len);
+
+    /**
+     * Drive the attention line from the pending events/changes and the
+     * sources enabled in REG_ATTN_CONFIG
+     */
+    static void updateAttention();
+
+#if I2C_COMMAND_QUEUE
+    /**
+     * Command task: waits for queued master writes and hands them to the
+     * callback, draining the whole queue on each wake-up
+     */
+    static void commandTask(void *pvParameters);
+#endif
+
+public:
+    // TWI slave hooks, called from the TWI interrupt (twi_slave.cpp) only
+
+    /**
+     * The master starts a write: its first byte is the register pointer,
+     * the following ones are stored in consecutive registers (only the
+     * I2C_RW ones, the others are skipped). Bytes landing in REG_MAILBOX
+     * fill a frame slot instead, handed over when the write ends (see
+     * CMD_FRAME_MAX_OPS): the master can send the next frame right away
+     * and check the acknowledgements along with its next telemetry burst.
+     */
+    static void _onWriteBegin();
+    static void _onWriteByte(uint8_t data);
+    static void _onWriteEnd();
+
+    /**
+     * The master starts a read: registers are served from the pointer on,
+     * auto-incrementing, out of the bank committed when the read began, so
+     * a combined write(reg)-then-read(n) returns n consecutive registers.
+     * The pointer itself is left untouched.
+     * REG_DIRTY bytes are cleared as they are transmitted: the master
+     * reads the bitmap, then bursts only the flagged registers.
+     * A read starting at REG_EVENT_FIFO drains the event FIFO instead, one
+     * record after the other; a record is only popped once its last byte
+     * has been sent, and EVENT_NONE bytes follow the last one.
+     * A read starting at REG_HISTORY streams the distance history the
+     * same way (see distance_history.h).
+     */
+    static void _onReadBegin();
+    static uint8_t _onReadByte();
     /**
-     * Wire handler called when the Master requests data
+     * Bookkeeping of the byte just loaded, run once the clock is released
+     * so that it overlaps with the transfer on the bus
      */
-    static void onRequestHandler();
+    static void _onReadByteSent();
+    static void _onReadEnd();
 };
 
 #endif // I2C_PROTOCOL_H
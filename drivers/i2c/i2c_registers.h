@@ -0,0 +1,125 @@
+#ifndef I2C_REGISTERS_H
+#define I2C_REGISTERS_H
+
+#include <inttypes.h>
+
+// Size of the register bank
+#define I2C_NUM_REGISTERS 80
+
+// Size of the changed-register bitmap (one bit per register)
+#define I2C_DIRTY_BYTES (I2C_NUM_REGISTERS / 8)
+
+// Access rights of the master (the firmware may write any register)
+#define I2C_RO 0  // Read-only, master writes are dropped
+#define I2C_RW 1  // Read-write, master writes reach the register callback
+#define I2C_RC 2  // Read-only, cleared as it is transmitted
+#define I2C_WO 3  // Write-only, collected by the TWI interrupt, reads as 0
+
+/*
+ * Register table: X(name, offset, width in bytes, access, description)
+ *
+ * Everything about a register is derived from its entry: the REG_<name>
+ * offset, the typed I2C_Protocol::set<>()/get<>() accessors, the master
+ * write rights and the Raspberry Pi side module (make i2c_registers.py).
+ * Multi-byte registers are big-endian (MSB at the lowest offset), so a
+ * burst read returns them ready to decode. Entries are listed by
+ * increasing offset and may not overlap (checked at compile time); the
+ * offsets left out read as 0.
+ *
+ * This header is also compiled on the host by the generator: no AVR
+ * include here.
+ */
+#define I2C_REGISTER_TABLE(X) \
+    X(STATUS,          0x00, 1, I2C_RO, "General system status") \
+    X(ALARM_STATE,     0x01, 1, I2C_RW, "Alarm state (0=off, 1=on)") \
+    X(MOTION_DETECTED, 0x02, 1, I2C_RO, "Motion detected by any sensor (0=no, 1=yes)") \
+    X(BUZZER_CMD,      0x03, 1, I2C_RW, "Buzzer command (0=off, 1=on)") \
+    X(LED_CMD,         0x04, 1, I2C_RW, "LED command (0=off, 1=on)") \
+    X(DISTANCE,        0x05, 2, I2C_RO, "Ultrasonic distance of sensor 0 (mm)") \
+    X(RFID_STATUS,     0x07, 1, I2C_RO, "RFID status (0=no tag, 1=tag present)") \
+    X(RFID_ID,         0x08, 8, I2C_RO, "RFID tag ID (8 ASCII characters)") \
+    X(ROTARY_ANGLE,    0x10, 1, I2C_RO, "Potentiometer angle") \
+    X(BUTTON_STATE,    0x11, 1, I2C_RO, "Button state (0=released, 1=pressed)") \
+    X(COMMAND,         0x12, 1, I2C_RW, "General command register") \
+    X(ERROR_CODE,      0x13, 1, I2C_RW, "Error code (ERR_*, write 0 to clear)") \
+    X(EVENT_COUNT,     0x14, 1, I2C_RO, "Number of events pending in the FIFO") \
+    X(EVENT_OVERFLOW,  0x15, 1, I2C_RW, "Events lost on a full FIFO (write 0 to clear)") \
+    X(EVENT_FIFO,      0x16, 1, I2C_RO, "Event FIFO window (see event_fifo.h)") \
+    X(ATTN_CONFIG,     0x17, 1, I2C_RW, "Attention line sources (ATTN_ON_* bits)") \
+    X(ISR_TIME,        0x18, 1, I2C_RW, "Worst-case TWI interrupt time, 4us units (write 0 to reset)") \
+    X(CMD_ACK,         0x19, 2, I2C_RO, "Last command frame handled: sequence number (MSB), CMD_* status (LSB)") \
+    X(CMD_NACK,        0x1B, 2, I2C_RO, "Last command frame rejected: sequence number (MSB), CMD_* status (LSB)") \
+    X(SAMPLE_SLOW,     0x1D, 1, I2C_RW, "Ultrasonic period when disarmed and quiet, 10ms units") \
+    X(SAMPLE_FAST,     0x1E, 1, I2C_RW, "Ultrasonic period when armed or after motion, 10ms units") \
+    X(SAMPLE_HOLD,     0x1F, 1, I2C_RW, "Time the fast period is kept after the last motion, seconds") \
+    X(MAILBOX,         0x20, 16, I2C_WO, "Command frame window (see I2C_Protocol::_onWriteBegin)") \
+    X(SENSOR_DISTANCE, 0x30, 8, I2C_RO, "Distance of each ultrasonic sensor (mm), 4 x 16 bits, 0 if absent") \
+    X(SENSOR_MOTION,   0x38, 1, I2C_RO, "Motion of each ultrasonic sensor (bit n = sensor n)") \
+    X(PRESENCE,        0x39, 1, I2C_RO, "Presence against the room baseline (bit n = sensor n)") \
+    X(BASELINE,        0x3A, 1, I2C_RW, "Sensors with a learned room baseline (bit n), write 0 to learn again") \
+    X(HISTORY,         0x3B, 1, I2C_RO, "Distance history window (see distance_history.h)") \
+    X(HISTORY_SOURCE,  0x3C, 1, I2C_RW, "Sensor recorded in the history, 0xFF = none") \
+    X(ALLOWLIST,       0x3D, 1, I2C_RO, "Badges in the local allow-list (synced by data frames, see allow_list.h)") \
+    X(RFID_HOLDOFF,    0x3E, 1, I2C_RW, "Repeats of a badge ignored until it is gone this long, 100ms units") \
+    X(RFID_CARD,       0x3F, 5, I2C_RO, "RFID tag ID, binary: version byte then card number, big-endian (the allow-list key)") \
+    X(HEAP_FREE,       0x44, 1, I2C_RO, "Heap left once the tasks are created, bytes (255 = 255 or more)") \
+    X(STACK_MARGIN,    0x45, 1, I2C_RO, "Smallest stack margin of the tasks so far, bytes (255 = 255 or more)") \
+    X(DIRTY,           I2C_NUM_REGISTERS - I2C_DIRTY_BYTES, I2C_DIRTY_BYTES, I2C_RC, \
+      "Changed-register bitmap, little-endian (bit n = register n)")
+
+// Register offsets: REG_STATUS, REG_DISTANCE...
+#define I2C_REGISTER_ENUM(name, offset, width, access, description) REG_##name = (offset),
+enum I2CRegister : uint8_t
+{
+    I2C_REGISTER_TABLE(I2C_REGISTER_ENUM)
+};
+#undef I2C_REGISTER_ENUM
+
+// Width in bytes of the register at an offset, 0 if no register starts there
+#define I2C_REGISTER_WIDTH(name, offset, width, access, description) (reg == (offset)) ? (width) :
+constexpr uint8_t i2cRegisterWidth(uint8_t reg)
+{
+    return I2C_REGISTER_TABLE(I2C_REGISTER_WIDTH) 0;
+}
+#undef I2C_REGISTER_WIDTH
+
+// Master access rights of the register covering an offset
+#define I2C_REGISTER_ACCESS(name, offset, width, access, description) \
+    (reg >= (offset) && reg < (offset) + (width)) ? (access) :
+constexpr uint8_t i2cRegisterAccess(uint8_t reg)
+{
+    return I2C_REGISTER_TABLE(I2C_REGISTER_ACCESS) I2C_RO;
+}
+#undef I2C_REGISTER_ACCESS
+
+namespace i2c_layout
+{
+#define I2C_REGISTER_OFFSET(name, offset, width, access, description) (offset),
+#define I2C_REGISTER_SIZE(name, offset, width, access, description) (width),
+constexpr uint8_t offsets[] = {I2C_REGISTER_TABLE(I2C_REGISTER_OFFSET)};
+constexpr uint8_t widths[] = {I2C_REGISTER_TABLE(I2C_REGISTER_SIZE)};
+#undef I2C_REGISTER_OFFSET
+#undef I2C_REGISTER_SIZE
+
+// Entries sorted, not overlapping, and within the bank
+constexpr bool valid(uint8_t i = 0, uint8_t end = 0)
+{
+    return i == sizeof(offsets) ? end <= I2C_NUM_REGISTERS
+                                : offsets[i] >= end && widths[i] > 0 && valid(i + 1, offsets[i] + widths[i]);
+}
+}
+
+static_assert(i2c_layout::valid(), "I2C_REGISTER_TABLE: registers overlap or exceed the bank");
+static_assert(REG_DIRTY + I2C_DIRTY_BYTES == I2C_NUM_REGISTERS, "The bitmap must close the bank");
+
+// Integer type of a register of a given width
+template <uint8_t Width>
+struct I2CRegisterType;
+template <>
+struct I2CRegisterType<1> { typedef uint8_t type; };
+template <>
+struct I2CRegisterType<2> { typedef uint16_t type; };
+template <>
+struct I2CRegisterType<4> { typedef uint32_t type; };
+
+#endif // I2C_REGISTERS_H
@@ -0,0 +1,122 @@
+#include "twi_slave.h"
+#include "i2c.h"
+#include "../timebase/timebase.h"
+#include <avr/interrupt.h>
+#include <compat/twi.h>
+
+// Release the clock and acknowledge the next byte
+#define TWCR_ACK (_BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA))
+
+static uint8_t g_enabled = 0;
+static volatile uint8_t g_busy = 0;
+
+void TWI_Slave::init(uint8_t address)
+{
+    // No internal pull-ups: the Raspberry Pi pulls SDA/SCL up to 3.3V
+    PORTC &= ~(_BV(PC4) | _BV(PC5));
+
+#ifdef I2C_ISR_PROFILING
+    I2C_PROFILE_PORT &= ~_BV(I2C_PROFILE_BIT);
+    I2C_PROFILE_DDR |= _BV(I2C_PROFILE_BIT);
+#endif
+
+    TWAR = address << 1; // General call disabled
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+    g_enabled = 1;
+}
+
+bool TWI_Slave::busy()
+{
+    return g_busy;
+}
+
+void TWI_Slave::resume()
+{
+    // TWINT left as is: a pending state raises the interrupt right away
+    if (g_enabled)
+        TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
+
+#ifdef I2C_ISR_PROFILING
+// 4us units since start, saturated
+static uint8_t elapsedSince(uint32_t start)
+{
+    uint32_t elapsed = (Timebase::micros() - start) / 4;
+    return elapsed > 0xFF ? 0xFF : elapsed;
+}
+#endif
+
+ISR(TWI_vect)
+{
+#ifdef I2C_ISR_PROFILING
+    uint32_t start = Timebase::micros();
+    I2C_PROFILE_PORT |= _BV(I2C_PROFILE_BIT);
+#endif
+    uint8_t twcr = TWCR_ACK;
+
+    switch (TW_STATUS)
+    {
+    // Slave receiver: register pointer, then data
+    case TW_SR_SLA_ACK:
+    case TW_SR_ARB_LOST_SLA_ACK:
+    case TW_SR_GCALL_ACK:
+    case TW_SR_ARB_LOST_GCALL_ACK:
+        g_busy = 1;
+        I2C_Protocol::_onWriteBegin();
+        break;
+    case TW_SR_DATA_ACK:
+    case TW_SR_GCALL_DATA_ACK:
+    {
+        // Release the clock first: storing and queueing the byte then
+        // overlaps with the transfer of the next one
+        uint8_t data = TWDR;
+        TWCR = TWCR_ACK;
+        twcr = 0;
+        I2C_Protocol::_onWriteByte(data);
+        break;
+    }
+    case TW_SR_STOP: // Stop or repeated start: no longer addressed, the bus may still be taken
+        g_busy = 0;
+        I2C_Protocol::_onWriteEnd();
+        break;
+
+    // Slave transmitter: TWDR must be loaded before TWINT is cleared
+    case TW_ST_SLA_ACK:
+    case TW_ST_ARB_LOST_SLA_ACK:
+        g_busy = 1;
+        I2C_Protocol::_onReadBegin();
+        // fall through
+    case TW_ST_DATA_ACK:
+        TWDR = I2C_Protocol::_onReadByte();
+        TWCR = TWCR_ACK;
+        twcr = 0;
+        I2C_Protocol::_onReadByteSent();
+        break;
+    case TW_ST_DATA_NACK:  // Master has read enough
+    case TW_ST_LAST_DATA:
+        g_busy = 0;
+        I2C_Protocol::_onReadEnd();
+        break;
+
+    case TW_BUS_ERROR:
+        // Illegal start/stop: release the lines and start over
+        g_busy = 0;
+        I2C_Protocol::_onReadEnd();
+        twcr |= _BV(TWSTO);
+        break;
+
+    default: // TW_SR_DATA_NACK, TW_NO_INFO...
+        break;
+    }
+
+    // Not released yet
+    if (twcr)
+        TWCR = twcr;
+
+#ifdef I2C_ISR_PROFILING
+    uint8_t elapsed = elapsedSince(start);
+    if (elapsed > I2C_Protocol::get<REG_ISR_TIME>())
+        I2C_Protocol::set<REG_ISR_TIME>(elapsed);
+    I2C_PROFILE_PORT &= ~_BV(I2C_PROFILE_BIT);
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef TWI_SLAVE_H
+#define TWI_SLAVE_H
+
+#include <avr/io.h>
+#include <inttypes.h>
+
+// Define I2C_ISR_PROFILING to hold a debug pin high while the TWI interrupt
+// runs (scope measurement) and keep its worst duration in REG_ISR_TIME.
+// Default pin: D10 (PB2)
+#ifndef I2C_PROFILE_DDR
+#define I2C_PROFILE_DDR  DDRB
+#define I2C_PROFILE_PORT PORTB
+#define I2C_PROFILE_BIT  PB2
+#endif
+
+/*
+ * Interrupt-driven TWI slave serving the I2C_Protocol register bank.
+ * Replaces Wire/twi.c for the slave role: every byte is read from or
+ * written to the bank directly by the interrupt (one interrupt per byte,
+ * no intermediate buffer), through the I2C_Protocol::_on* hooks.
+ */
+class TWI_Slave {
+public:
+    /**
+     * Enable the TWI peripheral in slave mode
+     * @param address 7-bit slave address
+     */
+    static void init(uint8_t address);
+
+    /**
+     * This slave is addressed: from the address match to the stop or
+     * repeated start ending its part. A master transaction of this node
+     * (the LCD) does not request its start meanwhile. Not a sign that the
+     * bus is free: it is not between a register pointer write and the
+     * repeated start read, nor between a start and the address. The
+     * master leaves that to the hardware (see LCD::twi_start)
+     */
+    static bool busy();
+
+    /**
+     * Give the peripheral back to the slave after a master transaction of
+     * this node, or when it lost the arbitration; an address match that
+     * happened meanwhile is served at once by the interrupt
+     */
+    static void resume();
+};
+
+#endif // TWI_SLAVE_H
@@ -6,54 +6,133 @@
 */
 
 #include "lcd.h"
-#include <string.h>
+#include "../i2c/twi_slave.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <avr/interrupt.h>
+#include <compat/twi.h>
+#ifdef LCD_BENCHMARK
+#include "../timebase/timebase.h"
+#endif
 
 // TWI Status
 #define TW_STATUS_MASK 0xF8
 
-// Internal helper functions
-static void command(uint8_t value);
-static void i2c_send_byte(uint8_t addr, uint8_t dta);
-static void i2c_send_bytes(uint8_t addr, uint8_t *dta, uint8_t len);
-
 // ========== TWI/I2C Implementation ==========
 
 void LCD::twi_init(void)
 {
 // Set SCL frequency = F_CPU / (16 + 2 * TWBR * prescaler)
-// For 100kHz with F_CPU = 16MHz: TWBR = 72, prescaler = 1
-#if F_CPU == 16000000UL
-    TWBR = 72;
-#elif F_CPU == 8000000UL
-    TWBR = 32;
-#else
-    TWBR = ((F_CPU / 100000UL) - 16) / 2;
+// With F_CPU = 16MHz: TWBR = 72 for 100kHz, 12 for 400kHz, prescaler = 1
+#if ((F_CPU / LCD_TWI_FREQ) - 16) / 2 < 10
+#error "LCD_TWI_FREQ too high for F_CPU: TWBR must be at least 10 in master mode"
 #endif
+    TWBR = ((F_CPU / LCD_TWI_FREQ) - 16) / 2;
+
+    TWSR = 0x00; // Prescaler = 1
+    if (!(TWCR & (1 << TWEN)))
+        TWCR = (1 << TWEN); // Enable TWI, unless the slave already did
+}
+
+// Wait for the end of a bus step, false after LCD_TWI_TIMEOUT_US
+static bool twi_wait(uint8_t flag, bool set)
+{
+    for (uint16_t us = 0; us < LCD_TWI_TIMEOUT_US; us++)
+    {
+        if (((TWCR & (1 << flag)) != 0) == set)
+            return true;
+        _delay_us(1);
+    }
+    return false;
+}
 
-    TWSR = 0x00;        // Prescaler = 1
-    TWCR = (1 << TWEN); // Enable TWI
+// Between two start attempts: let the other tasks run once the scheduler
+// does, spin before
+static void twi_pause(void)
+{
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+        vTaskDelay(1);
+    else
+        _delay_us(100);
 }
 
-void LCD::twi_start(void)
+bool LCD::twi_start(void)
 {
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-    while (!(TWCR & (1 << TWINT)))
-        ; // Wait for TWINT flag
+    for (uint8_t tries = 0; tries < LCD_TWI_START_TRIES; tries++)
+    {
+        // Request the start when no slave event is pending, TWEA kept set:
+        // the hardware holds the start until the bus is free, and still
+        // answers the Raspberry Pi meanwhile. The slave interrupt stays off
+        // until twi_stop()
+        uint8_t sreg = SREG;
+        cli();
+        if (TWI_Slave::busy() || (TWCR & (1 << TWINT)))
+        {
+            SREG = sreg;
+            twi_pause();
+            continue;
+        }
+        TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWEA);
+        SREG = sreg;
+
+        // Wait for the start, or for an address match; spinning, as a
+        // match stretches the clock of the Raspberry Pi until served
+        if (!twi_wait(TWINT, true))
+        {
+            // Bus still taken by another transaction: withdraw the request
+            twi_abort();
+            twi_pause();
+            continue;
+        }
+        if (twi_get_status() == TW_START)
+        {
+#ifdef LCD_BENCHMARK
+            transactions++;
+#endif
+            return true;
+        }
+
+        // Addressed as slave (TW_SR_SLA_ACK, TW_ST_SLA_ACK or their
+        // arbitration lost forms), lost the bus, or bus error: the slave
+        // interrupt takes over, then try again
+        TWI_Slave::resume();
+    }
+    return false;
 }
 
 void LCD::twi_stop(void)
 {
-    TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
-    while (TWCR & (1 << TWSTO))
-        ; // Wait for stop condition
+    // No stop after a lost arbitration: the bus belongs to the other
+    // master, maybe addressing this node's slave
+    if (twi_get_status() < TW_MT_ARB_LOST)
+    {
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN) | (1 << TWEA);
+        if (!twi_wait(TWSTO, false))
+        {
+            twi_abort();
+            return;
+        }
+    }
+    TWI_Slave::resume();
+}
+
+// A bus step timed out: reset the TWI logic, which releases SDA and SCL
+// and cancels a pending start, then hand the peripheral back
+void LCD::twi_abort(void)
+{
+    TWCR = 0;
+    TWCR = (1 << TWEN);
+    TWI_Slave::resume();
 }
 
-void LCD::twi_write(uint8_t data)
+uint8_t LCD::twi_write(uint8_t data)
 {
+    // TWEA set: an address match after a lost arbitration is acknowledged
     TWDR = data;
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    while (!(TWCR & (1 << TWINT)))
-        ; // Wait for TWINT flag
+    TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
+    if (!twi_wait(TWINT, true))
+        twi_abort(); // TW_NO_INFO from now on: the transaction fails
+    return twi_get_status();
 }
 
 uint8_t LCD::twi_get_status(void)
@@ -63,34 +142,62 @@ uint8_t LCD::twi_get_status(void)
 
 // ========== I2C Helper Functions ==========
 
-void LCD::i2c_send_byte(uint8_t addr, uint8_t dta)
+bool LCD::i2c_begin(uint8_t addr)
 {
-    twi_start();
-    twi_write((addr << 1) | 0); // Address + write bit
-    twi_write(dta);
-    twi_stop();
+    return twi_start() && twi_write((addr << 1) | 0) == TW_MT_SLA_ACK; // Address + write bit
 }
 
-void LCD::i2c_send_bytes(uint8_t addr, uint8_t *dta, uint8_t len)
+bool LCD::i2c_send_byte(uint8_t addr, uint8_t dta)
 {
-    twi_start();
-    twi_write((addr << 1) | 0); // Address + write bit
-    for (uint8_t i = 0; i < len; i++)
+    return i2c_send_bytes(addr, &dta, 1);
+}
+
+bool LCD::i2c_send_bytes(uint8_t addr, uint8_t *dta, uint8_t len)
+{
+    bool sent = i2c_begin(addr);
+    for (uint8_t i = 0; sent && i < len; i++)
     {
-        twi_write(dta[i]);
+        sent = twi_write(dta[i]) == TW_MT_DATA_ACK;
     }
     twi_stop();
+    return sent;
 }
 
 // ========== LCD Internal Functions ==========
 
-void LCD::command(uint8_t value)
+bool LCD::command(uint8_t value)
 {
     if (!initialized)
-        return;
+        return false;
 
-    uint8_t dta[2] = {0x80, value};
-    i2c_send_bytes(LCD_ADDRESS, dta, 2);
+    uint8_t dta[2] = {LCD_CONTROL_CO, value};
+    return i2c_send_bytes(LCD_ADDRESS, dta, 2);
+}
+
+void LCD::set_cell(uint8_t row, uint8_t col, uint8_t value)
+{
+    uint16_t bit = (uint16_t)1 << col;
+    shadow[row][col] = value;
+    if (value != screen[row][col])
+        dirty[row] |= bit;
+    else
+        dirty[row] &= ~bit;
+}
+
+// Cursor-set, then the cells of the run streamed from the shadow in
+// data-continuation mode, all in one transaction
+bool LCD::send_run(uint8_t row, uint8_t start, uint8_t end)
+{
+    bool sent = i2c_begin(LCD_ADDRESS) &&
+                twi_write(LCD_CONTROL_CO) == TW_MT_DATA_ACK &&
+                twi_write(LCD_SETDDRAMADDR | (row ? 0x40 : 0x00) | start) == TW_MT_DATA_ACK &&
+                twi_write(LCD_CONTROL_RS) == TW_MT_DATA_ACK;
+    for (uint8_t col = start; sent && col <= end; col++)
+    {
+        sent = twi_write(shadow[row][col]) == TW_MT_DATA_ACK;
+    }
+    twi_stop();
+    return sent;
 }
 
 // ========== Public LCD Functions ==========
@@ -129,8 +236,13 @@ void LCD::begin(uint8_t cols, uint8_t rows, uint8_t charsize)
     display_control = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
     display();
 
-    // Clear display
-    clear();
+    // Clear display, the shadow starts blank as well
+    command(LCD_CLEARDISPLAY);
+    _delay_ms(2);
+    memset(shadow, ' ', sizeof(shadow));
+    memset(screen, ' ', sizeof(screen));
+    memset(dirty, 0, sizeof(dirty));
+    curr_col = 0;
 
     // Set default text direction (left to right)
     display_mode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
@@ -139,24 +251,66 @@ void LCD::begin(uint8_t cols, uint8_t rows, uint8_t charsize)
 
 void LCD::clear()
 {
-    command(LCD_CLEARDISPLAY);
-    _delay_ms(2);
+    for (uint8_t row = 0; row < LCD_ROWS; row++)
+    {
+        for (uint8_t col = 0; col < LCD_COLS; col++)
+            set_cell(row, col, ' ');
+    }
+    home();
 }
 
 void LCD::home()
 {
-    command(LCD_RETURNHOME);
-    _delay_ms(2);
+    curr_col = 0;
+    curr_line = 0;
 }
 
 void LCD::set_cursor(uint8_t col, uint8_t row)
+{
+    curr_col = col;
+    curr_line = row;
+}
+
+void LCD::flush()
 {
     if (!initialized)
         return;
 
-    col = (row == 0 ? col | 0x80 : col | 0xc0);
-    uint8_t dta[2] = {0x80, col};
-    i2c_send_bytes(LCD_ADDRESS, dta, 2);
+    for (uint8_t row = 0; row < LCD_ROWS; row++)
+    {
+        uint8_t col = 0;
+        while (col < LCD_COLS && (dirty[row] >> col))
+        {
+            if (!(dirty[row] & ((uint16_t)1 << col)))
+            {
+                col++;
+                continue;
+            }
+
+            // Run from the first changed cell to the last one not followed
+            // by more than LCD_RUN_GAP clean cells
+            uint8_t start = col;
+            uint8_t end = col;
+            for (col++; col < LCD_COLS && col - end <= LCD_RUN_GAP + 1; col++)
+            {
+                if (dirty[row] & ((uint16_t)1 << col))
+                    end = col;
+            }
+            col = end + 1;
+
+            // Left dirty if the transaction failed, sent again next time
+            if (send_run(row, start, end))
+            {
+                memcpy(&screen[row][start], &shadow[row][start], end - start + 1);
+                for (uint8_t i = start; i <= end; i++)
+                    dirty[row] &= ~((uint16_t)1 << i);
+            }
+        }
+    }
+
+    // The data bursts moved the display cursor
+    if ((display_control & (LCD_CURSORON | LCD_BLINKON)) && curr_line < LCD_ROWS && curr_col < LCD_COLS)
+        command(LCD_SETDDRAMADDR | (curr_line ? 0x40 : 0x00) | curr_col);
 }
 
 void LCD::no_display()
@@ -262,8 +416,14 @@ void LCD::write(uint8_t value)
     if (!initialized)
         return;
 
-    uint8_t dta[2] = {0x40, value};
-    i2c_send_bytes(LCD_ADDRESS, dta, 2);
+    if (curr_line < LCD_ROWS && curr_col < LCD_COLS)
+        set_cell(curr_line, curr_col, value);
+
+    // Same moves as the display's address counter
+    if (display_mode & LCD_ENTRYLEFT)
+        curr_col++;
+    else
+        curr_col--;
 }
 
 void LCD::print(const unsigned char *str)
@@ -282,3 +442,68 @@ void LCD::print_P(const unsigned char *str)
         write(c);
     }
 }
+
+#ifdef LCD_BENCHMARK
+// One full-screen redraw through a LCD_BENCH_* path, every cell set to a
+// pattern character
+void LCD::bench_redraw(uint8_t mode, uint8_t pattern)
+{
+    uint8_t dta[LCD_COLS + 1];
+
+    for (uint8_t row = 0; row < LCD_ROWS; row++)
+    {
+        switch (mode)
+        {
+        case LCD_BENCH_CHAR:
+            command(LCD_SETDDRAMADDR | (row ? 0x40 : 0x00));
+            for (uint8_t col = 0; col < LCD_COLS; col++)
+            {
+                dta[0] = LCD_CONTROL_RS;
+                dta[1] = pattern;
+                i2c_send_bytes(LCD_ADDRESS, dta, 2);
+            }
+            break;
+        case LCD_BENCH_ROW:
+            command(LCD_SETDDRAMADDR | (row ? 0x40 : 0x00));
+            dta[0] = LCD_CONTROL_RS;
+            memset(&dta[1], pattern, LCD_COLS);
+            i2c_send_bytes(LCD_ADDRESS, dta, LCD_COLS + 1);
+            break;
+        default:
+            for (uint8_t col = 0; col < LCD_COLS; col++)
+                set_cell(row, col, pattern);
+            break;
+        }
+    }
+
+    if (mode >= LCD_BENCH_FLUSH)
+        flush();
+}
+
+void LCD::benchmark(LCDBenchResult results[LCD_BENCH_COUNT])
+{
+    for (uint8_t mode = 0; mode < LCD_BENCH_COUNT; mode++)
+    {
+        // Start from the pattern the unchanged case keeps redrawing
+        bench_redraw(LCD_BENCH_FLUSH, '#');
+        transactions = 0;
+
+        uint32_t start = Timebase::micros();
+        for (uint8_t round = 0; round < LCD_BENCH_ROUNDS; round++)
+        {
+            // Alternate patterns so that every cell changes
+            uint8_t pattern = (mode == LCD_BENCH_UNCHANGED || (round & 1)) ? '#' : '-';
+            bench_redraw(mode, pattern);
+        }
+        uint32_t elapsed = Timebase::micros() - start;
+
+        results[mode].transactions = transactions / LCD_BENCH_ROUNDS;
+        results[mode].us = elapsed / LCD_BENCH_ROUNDS;
+    }
+
+    // The raw paths bypassed the shadow: resynchronize on a blank screen
+    memset(screen, 0, sizeof(screen));
+    clear();
+    flush();
+}
+#endif
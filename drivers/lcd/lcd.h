@@ -11,10 +11,48 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/pgmspace.h>
+#include <string.h>
 
 // Device I2C Address
 #define LCD_ADDRESS (0x7c >> 1)
 
+// SCL frequency, fast mode (400kHz) when built with -DI2C_FAST_MODE
+#ifndef LCD_TWI_FREQ
+#ifdef I2C_FAST_MODE
+#define LCD_TWI_FREQ 400000UL
+#else
+#define LCD_TWI_FREQ 100000UL
+#endif
+#endif
+
+// Longest wait for one bus step (start, byte, stop) before the
+// transaction is dropped: several byte times at 100kHz
+#ifndef LCD_TWI_TIMEOUT_US
+#define LCD_TWI_TIMEOUT_US 1000
+#endif
+
+// Starts attempted while the Raspberry Pi holds the bus, ~1ms apart once
+// the scheduler runs, before a transaction gives up
+#ifndef LCD_TWI_START_TRIES
+#define LCD_TWI_START_TRIES 20
+#endif
+
+// Visible cells, mirrored in RAM (see LCD::flush)
+#define LCD_COLS 16
+#define LCD_ROWS 2
+
+// Clean cells between two changed runs resent rather than starting a new
+// run: a run costs a cursor-set and a data transaction
+#ifndef LCD_RUN_GAP
+#define LCD_RUN_GAP 3
+#endif
+
+// Control byte before each byte sent to the controller: Co = 1, another
+// control byte follows the next one; Co = 0, the rest of the transaction
+// is data (continuation). RS selects command or display RAM.
+#define LCD_CONTROL_CO 0x80
+#define LCD_CONTROL_RS 0x40
+
 // LCD Commands
 #define LCD_CLEARDISPLAY 0x01
 #define LCD_RETURNHOME 0x02
@@ -53,7 +91,44 @@
 #define LCD_5x10DOTS 0x04
 #define LCD_5x8DOTS 0x00
 
-// LCD class
+#ifdef LCD_BENCHMARK
+// Redraw paths compared by LCD::benchmark()
+#define LCD_BENCH_CHAR 0      // Cursor-set, then one transaction per character
+#define LCD_BENCH_ROW 1       // Cursor-set and data burst per row, two transactions
+#define LCD_BENCH_FLUSH 2     // flush(): one transaction per row
+#define LCD_BENCH_UNCHANGED 3 // flush() with nothing changed
+#define LCD_BENCH_COUNT 4
+
+#ifndef LCD_BENCH_ROUNDS
+#define LCD_BENCH_ROUNDS 8
+#endif
+
+struct LCDBenchResult
+{
+    uint16_t transactions;
+    uint32_t us;
+};
+#endif
+
+/*
+ * LCD class
+ *
+ * Text goes to a RAM shadow of the visible cells, and only flush() talks
+ * to the display: it sends the runs of cells that differ from what the
+ * display shows, each as one transaction (cursor-set, then the cells in
+ * data-continuation mode). A full-screen redraw is two transactions,
+ * one per row, instead of one per character. Redrawing an
+ * unchanged screen costs no bus traffic. The shadow assumes the display
+ * is not shifted (scroll_display_*, autoscroll); writes off the visible
+ * cells are dropped.
+ *
+ * The TWI peripheral is shared with the I2C slave (TWI_Slave). A start
+ * keeps the slave address acknowledged and is held by the hardware until
+ * the bus is free; if the Raspberry Pi addresses this node first, the
+ * peripheral goes back to the slave and the start is tried again. The
+ * Raspberry Pi controller does not arbitrate: a start of the Pi while an
+ * LCD transaction is on the bus corrupts both.
+ */
 class LCD
 {
 
@@ -65,15 +140,31 @@ private:
     uint8_t num_lines;
     uint8_t curr_line;
 
+    // Shadow of the cells, cells shown by the display, and their
+    // differences (bit n = column n)
+    uint8_t shadow[LCD_ROWS][LCD_COLS];
+    uint8_t screen[LCD_ROWS][LCD_COLS];
+    uint16_t dirty[LCD_ROWS];
+    uint8_t curr_col;
+
     void twi_init(void);
-    void twi_start(void);
+    bool twi_start(void);
     void twi_stop(void);
-    void twi_write(uint8_t data);
+    void twi_abort(void);
+    uint8_t twi_write(uint8_t data);
     uint8_t twi_get_status(void);
-    void i2c_send_byte(uint8_t addr, uint8_t dta);
-    void LCD::i2c_send_bytes(uint8_t addr, uint8_t *dta, uint8_t len);
+    bool i2c_begin(uint8_t addr);
+    bool i2c_send_byte(uint8_t addr, uint8_t dta);
+    bool i2c_send_bytes(uint8_t addr, uint8_t *dta, uint8_t len);
+
+    bool command(uint8_t value);
+    void set_cell(uint8_t row, uint8_t col, uint8_t value);
+    bool send_run(uint8_t row, uint8_t start, uint8_t end);
 
-    void command(uint8_t value);
+#ifdef LCD_BENCHMARK
+    uint16_t transactions; // Started since the last benchmark case
+    void bench_redraw(uint8_t mode, uint8_t pattern);
+#endif
 
 public:
     /* Initialize lcd structure and TWI (I2C) peripheral. */
@@ -82,8 +173,16 @@ public:
             display_mode(0),
             initialized(0),
             num_lines(0),
-            curr_line(0)
+            curr_line(0),
+            curr_col(0)
+#ifdef LCD_BENCHMARK
+            ,
+            transactions(0)
+#endif
     {
+        memset(shadow, ' ', sizeof(shadow));
+        memset(screen, ' ', sizeof(screen));
+        memset(dirty, 0, sizeof(dirty));
         twi_init();
     }
 
@@ -93,15 +192,21 @@ public:
      */
     void begin(uint8_t cols, uint8_t rows, uint8_t charsize);
 
-    /* Clear the display and set cursor to home (0,0). */
+    /* Clear the shadow and set cursor to home (0,0), shown at flush(). */
     void clear();
 
-    /* Return cursor to home position without clearing display. */
+    /* Return cursor to home position without clearing the shadow. */
     void home();
 
     /* Set cursor to given column and row (0-based). */
     void set_cursor(uint8_t col, uint8_t row);
 
+    /*
+     * Send the cells changed since the last flush, then place the visible
+     * cursor if enabled. Nothing is sent if no cell changed.
+     */
+    void flush();
+
     /* Turn the LCD display on (but keeps cursor/blink settings). */
     void display();
 
@@ -144,7 +249,7 @@ public:
     /* Create a custom character from PROGMEM-provided byte map (8 bytes). */
     void create_char_P(uint8_t location, const uint8_t *charmap);
 
-    /* Write a single byte/character to the current cursor position. */
+    /* Write a single byte/character to the shadow at the cursor position. */
     void write(uint8_t value);
 
     /* Write a NUL-terminated C string from RAM to the display. */
@@ -152,6 +257,16 @@ public:
 
     /* Write a NUL-terminated string stored in PROGMEM to the display. */
     void print_P(const unsigned char *str);
+
+#ifdef LCD_BENCHMARK
+    /*
+     * Time full-screen redraws (every cell changed, shadow left blank) for
+     * each LCD_BENCH_* path: transactions and microseconds per redraw,
+     * averaged over LCD_BENCH_ROUNDS. Needs the scheduler running
+     * (Timebase::micros).
+     */
+    void benchmark(LCDBenchResult results[LCD_BENCH_COUNT]);
+#endif
 };
 
 #endif
@@ -0,0 +1,75 @@
+#include "pcint.h"
+#include <avr/interrupt.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+static PinChangeHandler g_handlers[PCINT_BANKS][PCINT_MAX_HANDLERS];
+
+static volatile uint8_t *maskRegister(uint8_t bank)
+{
+    return bank == 0 ? &PCMSK0 : bank == 1 ? &PCMSK1 : &PCMSK2;
+}
+
+bool PinChange::attach(uint8_t bank, PinChangeHandler handler)
+{
+    bool attached = false;
+
+    if (bank >= PCINT_BANKS)
+        return false;
+
+    portENTER_CRITICAL();
+    for (uint8_t i = 0; i < PCINT_MAX_HANDLERS && !attached; i++)
+    {
+        if (g_handlers[bank][i] == NULL || g_handlers[bank][i] == handler)
+        {
+            g_handlers[bank][i] = handler;
+            attached = true;
+        }
+    }
+    if (attached)
+        PCICR |= _BV(bank);
+    portEXIT_CRITICAL();
+
+    return attached;
+}
+
+void PinChange::enable(uint8_t bank, uint8_t mask)
+{
+    // Read-modify-write shared with the other drivers of the bank
+    portENTER_CRITICAL();
+    *maskRegister(bank) |= mask;
+    portEXIT_CRITICAL();
+}
+
+void PinChange::disable(uint8_t bank, uint8_t mask)
+{
+    portENTER_CRITICAL();
+    *maskRegister(bank) &= ~mask;
+    portEXIT_CRITICAL();
+}
+
+static inline void dispatch(uint8_t bank)
+{
+    for (uint8_t i = 0; i < PCINT_MAX_HANDLERS; i++)
+    {
+        PinChangeHandler handler = g_handlers[bank][i];
+        if (handler == NULL)
+            break;
+        handler();
+    }
+}
+
+ISR(PCINT0_vect)
+{
+    dispatch(0);
+}
+
+ISR(PCINT1_vect)
+{
+    dispatch(1);
+}
+
+ISR(PCINT2_vect)
+{
+    dispatch(2);
+}
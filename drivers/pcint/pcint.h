@@ -0,0 +1,51 @@
+#ifndef PCINT_H
+#define PCINT_H
+
+#include <avr/io.h>
+#include <inttypes.h>
+
+// Pin change banks: PCINT0 (PORTB), PCINT1 (PORTC), PCINT2 (PORTD)
+#define PCINT_BANKS 3
+
+// Handlers per bank (e.g. RFID receiver and ultrasonic echo on PORTD)
+#ifndef PCINT_MAX_HANDLERS
+#define PCINT_MAX_HANDLERS 2
+#endif
+
+// Called from the pin change interrupt, for a change on any pin of the bank
+typedef void (*PinChangeHandler)(void);
+
+/*
+ * Owner of the pin change interrupt vectors, shared by the drivers (and by
+ * SoftwareSerial, built with SOFTWARESERIAL_SHARED_PCINT). Each driver
+ * attaches a handler to the bank of its pin and selects the pins with
+ * enable()/disable(); a handler must check that its own pin changed.
+ */
+class PinChange {
+public:
+    /**
+     * Bank of a port input register
+     * @param pin_reg &PINB, &PINC or &PIND
+     * @return Bank number, 0xFF for another register
+     */
+    static uint8_t bankOf(volatile uint8_t *pin_reg)
+    {
+        return pin_reg == &PINB ? 0 : pin_reg == &PINC ? 1 : pin_reg == &PIND ? 2 : 0xFF;
+    }
+
+    /**
+     * Call a handler on pin changes of a bank, in attachment order, and
+     * enable the bank interrupt. Handlers cannot be detached
+     * @return false if the bank already has PCINT_MAX_HANDLERS handlers
+     */
+    static bool attach(uint8_t bank, PinChangeHandler handler);
+
+    /**
+     * Enable/disable the pin change interrupt of pins of a bank
+     * @param mask Pins (bit n = pin n of the port)
+     */
+    static void enable(uint8_t bank, uint8_t mask);
+    static void disable(uint8_t bank, uint8_t mask);
+};
+
+#endif // PCINT_H
@@ -0,0 +1,157 @@
+#include "allow_list.h"
+#include "../i2c/i2c.h"
+#include "../eeprom/eeprom_lock.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+
+// EEPROM layout; count and CRC are written last by a commit
+struct AllowListStore
+{
+    uint8_t count;
+    uint8_t crc;
+    uint8_t keys[ALLOWLIST_MAX][ALLOWLIST_KEY_SIZE];
+};
+
+static AllowListStore EEMEM g_store;
+
+static uint8_t g_count = 0;          // Committed keys
+static uint8_t g_staged = 0xFF;      // Keys written by the sync in progress, 0xFF if none
+
+static int keyAddress(uint8_t index)
+{
+    return (int)&g_store.keys[index][0];
+}
+
+// Compare a key with a stored one, like memcmp
+static int8_t compareKey(const uint8_t *key, uint8_t index)
+{
+    EEPtr cell = keyAddress(index);
+    for (uint8_t i = 0; i < ALLOWLIST_KEY_SIZE; i++, ++cell)
+    {
+        uint8_t stored = *cell;
+        if (key[i] != stored)
+            return key[i] < stored ? -1 : 1;
+    }
+    return 0;
+}
+
+// Seeded with the key size: a list stored with other keys fails the check
+static uint8_t keysCrc(uint8_t count)
+{
+    uint8_t crc = _crc8_ccitt_update(ALLOWLIST_KEY_SIZE, count);
+    EEPtr cell = keyAddress(0);
+    for (uint16_t i = 0; i < (uint16_t)count * ALLOWLIST_KEY_SIZE; i++, ++cell)
+        crc = _crc8_ccitt_update(crc, *cell);
+    return crc;
+}
+
+static int8_t hexValue(uint8_t digit)
+{
+    if (digit >= '0' && digit <= '9')
+        return digit - '0';
+    if (digit >= 'A' && digit <= 'F')
+        return digit - 'A' + 10;
+    if (digit >= 'a' && digit <= 'f')
+        return digit - 'a' + 10;
+    return -1;
+}
+
+void AllowList::init()
+{
+    uint8_t count = EEPROM[(int)&g_store.count];
+    uint8_t crc = EEPROM[(int)&g_store.crc];
+    g_count = (count <= ALLOWLIST_MAX && keysCrc(count) == crc) ? count : 0;
+}
+
+uint8_t AllowList::count()
+{
+    return g_count;
+}
+
+bool AllowList::keyOf(const uint8_t *digits, uint8_t *key)
+{
+    for (uint8_t i = 0; i < ALLOWLIST_KEY_SIZE; i++)
+    {
+        int8_t high = hexValue(digits[2 * i]);
+        int8_t low = hexValue(digits[2 * i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        key[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+bool AllowList::contains(const uint8_t *key)
+{
+    bool found = false;
+    EepromLock::take();
+    uint8_t low = 0;
+    uint8_t high = g_count;
+    while (!found && low < high)
+    {
+        uint8_t middle = (low + high) / 2;
+        int8_t order = compareKey(key, middle);
+        if (order == 0)
+            found = true;
+        else if (order < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    EepromLock::give();
+    return found;
+}
+
+// Sync operation, EEPROM taken
+static uint8_t applySync(const uint8_t *data, uint8_t len)
+{
+    switch (data[0])
+    {
+    case ALLOWLIST_BEGIN:
+        // Invalidate first: a reset during the sync leaves an empty list
+        g_count = 0;
+        g_staged = 0;
+        EEPROM[(int)&g_store.count].update(0);
+        EEPROM[(int)&g_store.crc].update(keysCrc(0));
+        return CMD_OK;
+
+    case ALLOWLIST_ADD:
+        if ((len - 1) % ALLOWLIST_KEY_SIZE != 0)
+            return CMD_BAD_LENGTH;
+        for (uint8_t i = 1; i < len; i += ALLOWLIST_KEY_SIZE)
+        {
+            // Sorted as written, so the lookup can bisect
+            if (g_staged == 0xFF || g_staged >= ALLOWLIST_MAX ||
+                (g_staged > 0 && compareKey(&data[i], g_staged - 1) <= 0))
+            {
+                g_staged = 0xFF; // Start over with ALLOWLIST_BEGIN
+                return CMD_DENIED;
+            }
+            EEPtr cell = keyAddress(g_staged);
+            for (uint8_t j = 0; j < ALLOWLIST_KEY_SIZE; j++, ++cell)
+                (*cell).update(data[i + j]);
+            g_staged++;
+        }
+        return CMD_OK;
+
+    case ALLOWLIST_COMMIT:
+        if (g_staged == 0xFF)
+            return CMD_DENIED;
+        EEPROM[(int)&g_store.crc].update(keysCrc(g_staged));
+        EEPROM[(int)&g_store.count].update(g_staged);
+        g_count = g_staged;
+        g_staged = 0xFF;
+        return CMD_OK;
+
+    default:
+        return CMD_DENIED;
+    }
+}
+
+uint8_t AllowList::sync(const uint8_t *data, uint8_t len)
+{
+    EepromLock::take();
+    uint8_t status = applySync(data, len);
+    EepromLock::give();
+    return status;
+}
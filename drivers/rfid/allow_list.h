@@ -0,0 +1,62 @@
+#ifndef ALLOW_LIST_H
+#define ALLOW_LIST_H
+
+#include <inttypes.h>
+#include "rfid.h"
+
+// Badges kept in EEPROM (ALLOWLIST_KEY_SIZE bytes each)
+#ifndef ALLOWLIST_MAX
+#define ALLOWLIST_MAX 64
+#endif
+
+// Badge key: the 10 hex digits of the tag as 5 bytes, big-endian (REG_RFID_CARD)
+#define ALLOWLIST_KEY_SIZE (RFID_DATA_LENGTH / 2)
+
+// Sync operations, first payload byte of a data frame to REG_ALLOWLIST
+#define ALLOWLIST_BEGIN  0x01  // Empty the list, a sync starts
+#define ALLOWLIST_ADD    0x02  // Keys follow, in strictly increasing order over the sync
+#define ALLOWLIST_COMMIT 0x03  // Seal the list, lookups use it from now on
+
+/*
+ * Badges allowed to disarm the alarm locally, right after a read, without
+ * waiting for the master. The keys are stored sorted in EEPROM and looked
+ * up by binary search (log2(ALLOWLIST_MAX) probes of 5 bytes); a CRC
+ * checked at boot drops a list cut short by a reset.
+ *
+ * The master syncs the whole list with data frames (see CMD_FRAME_DATA):
+ * ALLOWLIST_BEGIN, ALLOWLIST_ADD frames with up to 2 keys each, then
+ * ALLOWLIST_COMMIT. Unchanged EEPROM bytes are not rewritten.
+ */
+class AllowList {
+public:
+    /**
+     * Check the stored list, to call once at boot before the scheduler
+     * starts (no EepromLock)
+     */
+    static void init();
+
+    // Badges in the committed list
+    static uint8_t count();
+
+    /**
+     * Key of a tag
+     * @param digits The RFID_DATA_LENGTH ASCII hex digits of the tag
+     * @return false if they are not all hex digits
+     */
+    static bool keyOf(const uint8_t *digits, uint8_t *key);
+
+    /**
+     * Lookup in the committed list
+     */
+    static bool contains(const uint8_t *key);
+
+    /**
+     * Apply one sync operation (I2C command task, blocks ~3.4ms per
+     * EEPROM byte written)
+     * @param data Payload of the data frame
+     * @return CMD_* status of the frame
+     */
+    static uint8_t sync(const uint8_t *data, uint8_t len);
+};
+
+#endif // ALLOW_LIST_H
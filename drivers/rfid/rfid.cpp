@@ -1,21 +1,127 @@
 #include "rfid.h"
+#include "../pcint/pcint.h"
+#include <pins_arduino.h>
+
+// Parser states (RFID_Reader::_state)
+#define PARSE_WAIT_STX 0
+#define PARSE_DATA     1  // Hex digits, data then checksum
+#define PARSE_WAIT_ETX 2
+
+// The pin change handler has no context: one reader
+static RFID_Reader *g_reader = NULL;
+
+static int8_t hexValue(uint8_t digit)
+{
+    if (digit >= '0' && digit <= '9')
+        return digit - '0';
+    if (digit >= 'A' && digit <= 'F')
+        return digit - 'A' + 10;
+    if (digit >= 'a' && digit <= 'f')
+        return digit - 'a' + 10;
+    return -1;
+}
+
+static uint8_t hexByte(const uint8_t *digits)
+{
+    return (hexValue(digits[0]) << 4) | hexValue(digits[1]);
+}
 
 void RFID_Reader::begin(long baudRate)
 {
-    SoftSerial.begin(baudRate);
+    _tags = xMessageBufferCreate(RFID_TAG_QUEUE * (RFID_DATA_LENGTH + sizeof(size_t)));
+    _state = PARSE_WAIT_STX;
+    _length = 0;
+    _badFrames = 0;
+    g_reader = this;
+
+#if RFID_TRANSPORT == RFID_USART
+    Usart::setReceiveHandler(_onReceive);
+#elif RFID_TRANSPORT == RFID_TIMER_SERIAL
+    TimerSerial::setReceiveHandler(_onReceive);
+#else
+    // SoftwareSerial enables its own pin, the vector belongs to PinChange
+    PinChange::attach(digitalPinToPCICRbit(_rxPin), _onPinChange);
+#endif
+    _serial.begin(baudRate);
 }
 
-bool RFID_Reader::dataAvailable()
+#if RFID_TRANSPORT == RFID_SOFTWARE_SERIAL
+// Pin change interrupt: let SoftwareSerial receive, then parse what it got
+void RFID_Reader::_onPinChange()
 {
-    return SoftSerial.available() > 0;
+    SoftwareSerial_handlePinChange();
+    _onReceive();
 }
+#endif
 
-size_t RFID_Reader::readData(uint8_t *buffer, size_t maxLength)
+// Receive interrupt of the transport: parse the bytes received so far
+void RFID_Reader::_onReceive()
 {
-    size_t count = 0;
-    while (SoftSerial.available() && count < maxLength)
+    RFID_Reader *reader = g_reader;
+    bool woken = false;
+    while (reader->_serial.available())
     {
-        buffer[count++] = SoftSerial.read();
+        woken |= reader->_onByte(reader->_serial.read());
     }
-    return count;
+    if (woken) taskYIELD();
+}
+
+// One byte of the reader (interrupt context), returns true if a task
+// waiting for a tag was woken
+bool RFID_Reader::_onByte(uint8_t byte)
+{
+    if (byte == RFID_STX)
+    {
+        // Start of frame, even in the middle of a broken one
+        if (_state != PARSE_WAIT_STX)
+            _badFrames++;
+        _state = PARSE_DATA;
+        _length = 0;
+        return false;
+    }
+
+    switch (_state)
+    {
+    case PARSE_DATA:
+        if (hexValue(byte) < 0)
+            break;
+        _frame[_length++] = byte;
+        if (_length == sizeof(_frame))
+            _state = PARSE_WAIT_ETX;
+        return false;
+    case PARSE_WAIT_ETX:
+        if (byte != RFID_ETX)
+            break;
+        _state = PARSE_WAIT_STX;
+
+        {
+            uint8_t checksum = 0;
+            for (uint8_t i = 0; i < RFID_DATA_LENGTH; i += 2)
+                checksum ^= hexByte(&_frame[i]);
+            if (checksum != hexByte(&_frame[RFID_DATA_LENGTH]))
+            {
+                _badFrames++;
+                return false;
+            }
+        }
+
+        {
+            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+            if (xMessageBufferSendFromISR(_tags, _frame, RFID_DATA_LENGTH, &xHigherPriorityTaskWoken) == 0)
+                _badFrames++;
+            return xHigherPriorityTaskWoken;
+        }
+    default:
+        return false; // Noise between frames
+    }
+
+    // Malformed frame: wait for the next STX
+    _state = PARSE_WAIT_STX;
+    _badFrames++;
+    return false;
+}
+
+bool RFID_Reader::waitTag(uint8_t *id, TickType_t timeout)
+{
+    return xMessageBufferReceive(_tags, id, RFID_DATA_LENGTH, timeout) == RFID_DATA_LENGTH;
 }
@@ -1,18 +1,73 @@
 #ifndef RFID_H
 #define RFID_H
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "message_buffer.h"
+
+#include "rfid_transport.h"
+
+#if RFID_TRANSPORT == RFID_USART
+#include "../usart/usart.h"
+typedef Usart RFIDSerial;
+#elif RFID_TRANSPORT == RFID_TIMER_SERIAL
+#include "../timer_serial/timer_serial.h"
+typedef TimerSerial RFIDSerial;
+#else
 #include <SoftwareSerial.h>
+typedef SoftwareSerial RFIDSerial;
+#endif
+
+// Reader frame: STX, 10 hex digits (version byte then 4-byte card
+// number), 2 hex digits of checksum (XOR of the 5 bytes), ETX
+#define RFID_STX 0x02
+#define RFID_ETX 0x03
+#define RFID_DATA_LENGTH 10
+#define RFID_CHECKSUM_LENGTH 2
+
+// Valid tags waiting for the task
+#ifndef RFID_TAG_QUEUE
+#define RFID_TAG_QUEUE 2
+#endif
 
 class RFID_Reader
 {
 private:
-    SoftwareSerial SoftSerial;
+    RFIDSerial _serial;
+    int _rxPin;
+
+    // Frame parser, fed from the pin change interrupt
+    MessageBufferHandle_t _tags;
+    uint8_t _frame[RFID_DATA_LENGTH + RFID_CHECKSUM_LENGTH];
+    uint8_t _state;
+    uint8_t _length;
+    uint8_t _badFrames;
+
+    bool _onByte(uint8_t byte);
+    static void _onReceive();
+#if RFID_TRANSPORT == RFID_SOFTWARE_SERIAL
+    static void _onPinChange();
+#endif
 
 public:
-    RFID_Reader(int rxPin, int txPin) : SoftSerial(rxPin, txPin) {}
+    // Pins of the serial link, unused with the USART
+#if RFID_TRANSPORT == RFID_USART
+    RFID_Reader(int rxPin, int txPin) : _rxPin(rxPin) {}
+#else
+    RFID_Reader(int rxPin, int txPin) : _serial(rxPin, txPin), _rxPin(rxPin) {}
+#endif
     void begin(long baudRate = 9600);
-    bool dataAvailable();
-    size_t readData(uint8_t *buffer, size_t maxLength);
+
+    /**
+     * Block until a tag is read, whole frame with a valid checksum
+     * @param id The RFID_DATA_LENGTH ASCII hex digits of the tag
+     * @param timeout Ticks to wait, portMAX_DELAY for ever
+     * @return false on timeout
+     */
+    bool waitTag(uint8_t *id, TickType_t timeout = portMAX_DELAY);
+
+    // Frames dropped so far: bad checksum, stray byte, or task too slow
+    uint8_t badFrames() const { return _badFrames; }
 };
 
 #endif
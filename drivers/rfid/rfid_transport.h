@@ -0,0 +1,15 @@
+#ifndef RFID_TRANSPORT_H
+#define RFID_TRANSPORT_H
+
+// Serial link to the reader, chosen at build time (RFID_TRANSPORT). The
+// drivers of the links not chosen compile to nothing, so their interrupt
+// vectors and buffers stay out of the image.
+#define RFID_SOFTWARE_SERIAL 0  // SoftwareSerial on any pin, blocks the interrupts ~1ms per byte
+#define RFID_USART           1  // Hardware USART, reader TX on D0
+#define RFID_TIMER_SERIAL    2  // Software receiver timed by Timer2, any pin
+
+#ifndef RFID_TRANSPORT
+#define RFID_TRANSPORT RFID_SOFTWARE_SERIAL
+#endif
+
+#endif // RFID_TRANSPORT_H
@@ -0,0 +1,48 @@
+#include "tag_dedup.h"
+#include <string.h>
+
+// Digits checked by the frame parser: 0-9, A-F or a-f
+static uint8_t nibble(uint8_t digit)
+{
+    return digit <= '9' ? digit - '0' : (digit | 0x20) - 'a' + 10;
+}
+
+TagDedup::TagDedup()
+{
+    _used = 0;
+}
+
+bool TagDedup::accept(const uint8_t *frame, uint32_t now_ms, uint32_t holdoff_ms)
+{
+    uint8_t id[ID_SIZE];
+    for (uint8_t i = 0; i < ID_SIZE; i++)
+        id[i] = (nibble(frame[2 * i]) << 4) | nibble(frame[2 * i + 1]);
+
+    // Known tag: a repeat while within the hold-off
+    for (uint8_t i = 0; i < _used; i++)
+    {
+        if (memcmp(_ids[i], id, ID_SIZE) == 0)
+        {
+            bool repeat = now_ms - _seen[i] < holdoff_ms;
+            _seen[i] = now_ms;
+            return !repeat;
+        }
+    }
+
+    // New tag: free slot, or the one seen the longest ago
+    uint8_t slot = _used;
+    if (_used < RFID_DEDUP_SLOTS)
+        _used++;
+    else
+    {
+        slot = 0;
+        for (uint8_t i = 1; i < RFID_DEDUP_SLOTS; i++)
+        {
+            if (now_ms - _seen[i] > now_ms - _seen[slot])
+                slot = i;
+        }
+    }
+    memcpy(_ids[slot], id, ID_SIZE);
+    _seen[slot] = now_ms;
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef TAG_DEDUP_H
+#define TAG_DEDUP_H
+
+#include <inttypes.h>
+#include "rfid.h"
+
+// Tags remembered at once, the least recently seen is forgotten first
+#ifndef RFID_DEDUP_SLOTS
+#define RFID_DEDUP_SLOTS 4
+#endif
+
+/*
+ * Squashes the repeats of a badge held in front of the reader, which sends
+ * its frame over and over, while another badge is reported at once. Each
+ * slot holds a tag and when it was last seen; a repeat extends the
+ * hold-off, so a badge left on the reader is reported once.
+ */
+class TagDedup {
+public:
+    TagDedup();
+
+    /**
+     * @param frame The RFID_DATA_LENGTH hex digits of a valid tag
+     * @param now_ms Timebase::millis() of the read
+     * @param holdoff_ms Repeats closer than this to the previous read are
+     * squashed
+     * @return true if the tag is to be reported
+     */
+    bool accept(const uint8_t *frame, uint32_t now_ms, uint32_t holdoff_ms);
+
+private:
+    static const uint8_t ID_SIZE = RFID_DATA_LENGTH / 2;
+
+    uint8_t _ids[RFID_DEDUP_SLOTS][ID_SIZE];
+    uint32_t _seen[RFID_DEDUP_SLOTS];
+    uint8_t _used;
+};
+
+#endif // TAG_DEDUP_H
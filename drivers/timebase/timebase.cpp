@@ -0,0 +1,63 @@
+#include "timebase.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if configUSE_TICK_HOOK != 1
+#error "The timebase needs configUSE_TICK_HOOK"
+#endif
+static_assert(configTICK_RATE_HZ == 1000, "The timebase counts one tick per millisecond");
+
+// Microseconds per Timer1 count (prescaler 64)
+#define TIMEBASE_US_PER_COUNT (64000000UL / F_CPU)
+
+static volatile uint32_t g_millis = 0;
+static volatile TickCallback g_tick_callback = NULL;
+
+// Called from the tick interrupt, once per tick even while the scheduler
+// is suspended
+extern "C" void vApplicationTickHook(void)
+{
+    g_millis++;
+
+    TickCallback callback = g_tick_callback;
+    if (callback != NULL)
+        callback();
+}
+
+uint32_t Timebase::micros()
+{
+    uint32_t ms;
+    uint16_t count;
+
+    portENTER_CRITICAL();
+    ms = g_millis;
+    count = TCNT1;
+    // The timer cleared but the tick is still pending (interrupts off):
+    // count the millisecond, and take a count from after the clear
+    if (TIFR1 & _BV(OCF1A))
+    {
+        count = TCNT1;
+        ms++;
+    }
+    portEXIT_CRITICAL();
+
+    return ms * 1000 + count * TIMEBASE_US_PER_COUNT;
+}
+
+void Timebase::setTickCallback(TickCallback callback)
+{
+    portENTER_CRITICAL();
+    g_tick_callback = callback;
+    portEXIT_CRITICAL();
+}
+
+uint32_t Timebase::millis()
+{
+    uint32_t ms;
+
+    portENTER_CRITICAL();
+    ms = g_millis;
+    portEXIT_CRITICAL();
+
+    return ms;
+}
@@ -0,0 +1,42 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <avr/io.h>
+#include <inttypes.h>
+
+// Called from the tick interrupt, every millisecond
+typedef void (*TickCallback)(void);
+
+/*
+ * Monotonic clock shared by the drivers, built on the FreeRTOS tick timer:
+ * Timer1 in CTC mode, prescaler 64 (4us per count), cleared every 1ms
+ * (port.c). A 32-bit millisecond count kept by the tick hook is combined
+ * with the live Timer1 count.
+ *
+ * Needs configUSE_TICK_HOOK (the hook is defined in timebase.cpp) and a
+ * 1kHz tick. Both functions may be called from tasks and from interrupt
+ * handlers; they read 0 until the scheduler is started.
+ */
+class Timebase {
+public:
+    /**
+     * Microseconds since the scheduler started, 4us resolution,
+     * wraps after ~71 minutes (unsigned differences stay valid)
+     */
+    static uint32_t micros();
+
+    /**
+     * Milliseconds since the scheduler started, wraps after ~49 days
+     */
+    static uint32_t millis();
+
+    /**
+     * Run a callback on every tick (a single one, e.g. driver timeouts).
+     * It runs inside the tick interrupt: keep it short, use the FromISR
+     * API, and do not yield (the tick switches tasks itself)
+     * @param callback Function to call, NULL to remove it
+     */
+    static void setTickCallback(TickCallback callback);
+};
+
+#endif // TIMEBASE_H
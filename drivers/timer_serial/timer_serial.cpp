@@ -0,0 +1,172 @@
+#include "timer_serial.h"
+#include "../pcint/pcint.h"
+#include "../rfid/rfid_transport.h"
+#include <avr/interrupt.h>
+
+// Only linked in when it carries the RFID reader: the Timer2 vector would
+// be taken (and tone() ruled out) even if unused
+#if RFID_TRANSPORT == RFID_TIMER_SERIAL
+
+#if (TIMER_SERIAL_RX_BUFFER_SIZE & (TIMER_SERIAL_RX_BUFFER_SIZE - 1)) || TIMER_SERIAL_RX_BUFFER_SIZE > 128
+#error "TIMER_SERIAL_RX_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+// RX pin
+static volatile uint8_t *g_pin_reg = &PIND;
+static volatile uint8_t *g_port = &PORTD;
+static volatile uint8_t *g_ddr = &DDRD;
+static uint8_t g_pin_mask = 0;
+static uint8_t g_bank = 0;
+
+// Timer2 clock select and periods (timer counts - 1, CTC mode)
+static uint8_t g_clock_select = 0;
+static uint8_t g_bit_ocr = 0;
+static uint8_t g_first_ocr = 0; // Start edge to the middle of bit 0
+
+// Character being received (timer interrupt only)
+static volatile uint8_t g_receiving = 0;
+static uint8_t g_bit = 0;
+static uint8_t g_byte = 0;
+
+static volatile uint8_t g_rx[TIMER_SERIAL_RX_BUFFER_SIZE];
+static volatile uint8_t g_rx_head = 0; // Next byte read
+static volatile uint8_t g_rx_tail = 0; // Next byte stored
+static volatile uint8_t g_errors = 0;
+static TimerSerialReceiveHandler g_handler = NULL;
+
+static void countError()
+{
+    if (g_errors < 0xFF)
+        g_errors++;
+}
+
+TimerSerial::TimerSerial(uint8_t rxPin, uint8_t txPin)
+{
+    // Arduino Uno numbering: D0-D7 PORTD, D8-D13 PORTB, A0-A5 PORTC
+    if (rxPin < 8)
+    {
+        g_pin_reg = &PIND;
+        g_port = &PORTD;
+        g_ddr = &DDRD;
+    }
+    else if (rxPin < 14)
+    {
+        g_pin_reg = &PINB;
+        g_port = &PORTB;
+        g_ddr = &DDRB;
+        rxPin -= 8;
+    }
+    else
+    {
+        g_pin_reg = &PINC;
+        g_port = &PORTC;
+        g_ddr = &DDRC;
+        rxPin -= 14;
+    }
+    g_pin_mask = _BV(rxPin);
+    g_bank = PinChange::bankOf(g_pin_reg);
+}
+
+void TimerSerial::begin(long baudRate)
+{
+    // Smallest Timer2 prescaler for which 1.5 bit fits the 8-bit counter
+    static const uint16_t prescalers[] = {1, 8, 32, 64, 128, 256, 1024};
+    const uint8_t count = sizeof(prescalers) / sizeof(prescalers[0]);
+    uint8_t i = 0;
+    uint32_t bit_counts = (F_CPU + baudRate / 2) / baudRate;
+    while (bit_counts * 3 / 2 > 256 && i < count - 1)
+    {
+        i++;
+        bit_counts = (F_CPU / prescalers[i] + baudRate / 2) / baudRate;
+    }
+    g_clock_select = i + 1;
+    g_bit_ocr = bit_counts - 1;
+    g_first_ocr = bit_counts * 3 / 2 - 1;
+
+    TCCR2B = 0; // Stopped until a start bit
+    TCCR2A = _BV(WGM21);
+    TIMSK2 = _BV(OCIE2A);
+
+    // Input with pull-up: the line idles high
+    *g_ddr &= ~g_pin_mask;
+    *g_port |= g_pin_mask;
+
+    PinChange::attach(g_bank, _onPinChange);
+    PinChange::enable(g_bank, g_pin_mask);
+}
+
+// Pin change interrupt: a falling edge while idle is a start bit, the
+// timer takes over until the stop bit
+void TimerSerial::_onPinChange()
+{
+    if (g_receiving || (*g_pin_reg & g_pin_mask))
+        return;
+
+    g_receiving = 1;
+    g_bit = 0;
+    PinChange::disable(g_bank, g_pin_mask);
+    TCNT2 = 0;
+    OCR2A = g_first_ocr;
+    TIFR2 = _BV(OCF2A);
+    TCCR2B = g_clock_select;
+}
+
+// Middle of a bit: shift a data bit in, or check the stop bit and store
+ISR(TIMER2_COMPA_vect)
+{
+    uint8_t high = *g_pin_reg & g_pin_mask;
+    if (g_bit < 8)
+    {
+        if (g_bit == 0)
+            OCR2A = g_bit_ocr;
+        g_byte >>= 1;
+        if (high)
+            g_byte |= 0x80;
+        g_bit++;
+        return;
+    }
+
+    // Stop bit: back to waiting for an edge
+    TCCR2B = 0;
+    g_receiving = 0;
+    PinChange::enable(g_bank, g_pin_mask);
+
+    uint8_t next = (g_rx_tail + 1) & (TIMER_SERIAL_RX_BUFFER_SIZE - 1);
+    if (!high || next == g_rx_head)
+    {
+        countError(); // Framing error, or no room
+        return;
+    }
+    g_rx[g_rx_tail] = g_byte;
+    g_rx_tail = next;
+
+    if (g_handler != NULL)
+        g_handler();
+}
+
+int TimerSerial::available()
+{
+    return (uint8_t)(g_rx_tail - g_rx_head) & (TIMER_SERIAL_RX_BUFFER_SIZE - 1);
+}
+
+int TimerSerial::read()
+{
+    uint8_t head = g_rx_head;
+    if (head == g_rx_tail)
+        return -1;
+    uint8_t byte = g_rx[head];
+    g_rx_head = (head + 1) & (TIMER_SERIAL_RX_BUFFER_SIZE - 1);
+    return byte;
+}
+
+void TimerSerial::setReceiveHandler(TimerSerialReceiveHandler handler)
+{
+    g_handler = handler;
+}
+
+uint8_t TimerSerial::errors()
+{
+    return g_errors;
+}
+
+#endif // RFID_TRANSPORT == RFID_TIMER_SERIAL
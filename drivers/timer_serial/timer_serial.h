@@ -0,0 +1,47 @@
+#ifndef TIMER_SERIAL_H
+#define TIMER_SERIAL_H
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+// Bytes received ahead of the reader (power of two)
+#ifndef TIMER_SERIAL_RX_BUFFER_SIZE
+#define TIMER_SERIAL_RX_BUFFER_SIZE 16
+#endif
+
+// Called from the timer interrupt after each byte is stored
+typedef void (*TimerSerialReceiveHandler)(void);
+
+/*
+ * Software UART receiver (8N1) on any pin, for boards whose USART is
+ * taken. The start bit edge is caught by the pin change interrupt, then
+ * Timer2 interrupts in the middle of each bit to sample it: one short
+ * interrupt per bit instead of SoftwareSerial spinning in the pin change
+ * interrupt for the whole character, so the other interrupts wait a few
+ * microseconds at most. Receive only (Timer2 and the pin change bank of
+ * the pin are used), same read interface as SoftwareSerial. Only built in
+ * with RFID_TRANSPORT == RFID_TIMER_SERIAL (rfid_transport.h).
+ */
+class TimerSerial {
+public:
+    // Arduino pin numbers; the TX pin is not driven
+    TimerSerial(uint8_t rxPin, uint8_t txPin);
+
+    static void begin(long baudRate);
+    static int available();
+
+    // Oldest byte received, -1 if none
+    static int read();
+
+    // Called in the timer interrupt, e.g. to parse as the bytes arrive
+    static void setReceiveHandler(TimerSerialReceiveHandler handler);
+
+    // Bytes lost: missing stop bit or full buffer
+    static uint8_t errors();
+
+private:
+    static void _onPinChange();
+};
+
+#endif // TIMER_SERIAL_H
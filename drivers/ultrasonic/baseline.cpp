@@ -0,0 +1,140 @@
+#include "baseline.h"
+#include "../eeprom/eeprom_lock.h"
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+// EEPROM record, checked by a CRC-8 (a blank EEPROM reads 0xFF)
+#define BASELINE_VERSION 1
+
+struct BaselineRecord
+{
+    uint8_t version;
+    uint8_t count;
+    uint16_t mean[BASELINE_MAX_SENSORS];
+    uint16_t deviation[BASELINE_MAX_SENSORS];
+    uint8_t crc;
+};
+
+static BaselineRecord EEMEM g_stored;
+
+static uint8_t recordCrc(const BaselineRecord *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < sizeof(BaselineRecord) - 1; i++)
+        crc = _crc8_ccitt_update(crc, bytes[i]);
+    return crc;
+}
+
+static uint16_t absDiff(uint16_t a, uint16_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+RoomBaseline::RoomBaseline()
+{
+    reset();
+}
+
+void RoomBaseline::reset()
+{
+    _mean = 0;
+    _deviation = 0;
+    _saved_mean = 0; // The relearned baseline is saved, however close to the old one
+    _samples = 0;
+    _streak = 0;
+    _presence = false;
+}
+
+bool RoomBaseline::update(uint16_t distance_mm, bool learn)
+{
+    uint16_t sample = distance_mm << FRACTION_BITS;
+    uint16_t error = absDiff(sample, _mean);
+
+    if (learn)
+    {
+        if (_samples == 0)
+        {
+            // First sample: nothing to average with yet
+            _mean = sample;
+            _deviation = 0;
+            _samples = 1;
+            return _presence;
+        }
+
+        // Fast while learning, then only the slow drift
+        uint8_t shift = learned() ? BASELINE_DRIFT_SHIFT : BASELINE_LEARN_SHIFT;
+        int32_t step = (int32_t)sample - _mean;
+        _mean += step >> shift;
+        int32_t deviation_step = (int32_t)error - _deviation;
+        _deviation += deviation_step >> shift;
+        if (!learned())
+            _samples++;
+    }
+
+    if (!learned())
+        return _presence;
+
+    // Presence flips only after BASELINE_CONFIRM contradicting samples
+    uint32_t threshold = (uint32_t)_deviation * BASELINE_K + (BASELINE_MIN_MM << FRACTION_BITS);
+    bool deviates = error > threshold;
+    if (deviates != _presence)
+    {
+        if (++_streak >= BASELINE_CONFIRM)
+        {
+            _presence = deviates;
+            _streak = 0;
+        }
+    }
+    else
+        _streak = 0;
+    return _presence;
+}
+
+bool RoomBaseline::stale() const
+{
+    if (!learned())
+        return false;
+    return _saved_mean == 0 || absDiff(_mean, _saved_mean) >= (BASELINE_SAVE_MM << FRACTION_BITS);
+}
+
+bool RoomBaseline::load(RoomBaseline *baselines, uint8_t count)
+{
+    BaselineRecord record;
+    EepromLock::take();
+    eeprom_read_block(&record, &g_stored, sizeof(record));
+    EepromLock::give();
+    if (record.version != BASELINE_VERSION || record.count != count ||
+        count > BASELINE_MAX_SENSORS || record.crc != recordCrc(&record))
+        return false;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        baselines[i].reset();
+        baselines[i]._mean = record.mean[i];
+        baselines[i]._deviation = record.deviation[i];
+        baselines[i]._saved_mean = record.mean[i];
+        baselines[i]._samples = BASELINE_LEARN_SAMPLES;
+    }
+    return true;
+}
+
+void RoomBaseline::save(RoomBaseline *baselines, uint8_t count)
+{
+    if (count > BASELINE_MAX_SENSORS)
+        count = BASELINE_MAX_SENSORS;
+
+    BaselineRecord record = {};
+    record.version = BASELINE_VERSION;
+    record.count = count;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        record.mean[i] = baselines[i]._mean;
+        record.deviation[i] = baselines[i]._deviation;
+        baselines[i]._saved_mean = baselines[i]._mean;
+    }
+    record.crc = recordCrc(&record);
+    EepromLock::take();
+    eeprom_update_block(&record, &g_stored, sizeof(record));
+    EepromLock::give();
+}
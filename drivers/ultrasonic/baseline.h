@@ -0,0 +1,110 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include <inttypes.h>
+
+// Samples of the empty room before the baseline is trusted, learned with
+// alpha = 1 / 2^BASELINE_LEARN_SHIFT
+#ifndef BASELINE_LEARN_SAMPLES
+#define BASELINE_LEARN_SAMPLES 32
+#endif
+#ifndef BASELINE_LEARN_SHIFT
+#define BASELINE_LEARN_SHIFT 3
+#endif
+
+// Drift tracking once learned: alpha = 1 / 2^BASELINE_DRIFT_SHIFT, about
+// two minutes at the slow sampling period
+#ifndef BASELINE_DRIFT_SHIFT
+#define BASELINE_DRIFT_SHIFT 7
+#endif
+
+// Presence: deviation from the baseline beyond K mean absolute deviations
+// (~3 sigma for K = 4) plus a floor for a very steady room, for
+// BASELINE_CONFIRM samples in a row (same count to clear it)
+#ifndef BASELINE_K
+#define BASELINE_K 4
+#endif
+#ifndef BASELINE_MIN_MM
+#define BASELINE_MIN_MM 60
+#endif
+#ifndef BASELINE_CONFIRM
+#define BASELINE_CONFIRM 3
+#endif
+
+// Drift of the mean that makes the stored baseline stale
+#ifndef BASELINE_SAVE_MM
+#define BASELINE_SAVE_MM 50
+#endif
+
+// Shortest time between two saves, spares the EEPROM (100k write cycles)
+#ifndef BASELINE_SAVE_INTERVAL_MS
+#define BASELINE_SAVE_INTERVAL_MS 600000UL
+#endif
+
+// Baselines kept in EEPROM
+#define BASELINE_MAX_SENSORS 4
+
+/*
+ * Distance profile of the empty room seen by one ranger: mean distance and
+ * mean absolute deviation, both EWMA in Q12.4. It is learned while the
+ * alarm is disarmed, keeps following slow changes (a moved chair, the
+ * temperature drift of the speed of sound) and flags presence when the
+ * distance leaves the band the room itself produces. Fed with the output
+ * of DistanceFilter, no echo being its far distance.
+ */
+class RoomBaseline {
+public:
+    RoomBaseline();
+
+    /**
+     * Forget the baseline and learn it again; saved once learned
+     */
+    void reset();
+
+    /**
+     * Feed a smoothed sample
+     * @param distance_mm Distance (mm)
+     * @param learn The room is expected empty (disarmed, no motion): the
+     * baseline follows the sample
+     * @return Presence state
+     */
+    bool update(uint16_t distance_mm, bool learn);
+
+    // Enough samples learned to flag presence
+    bool learned() const { return _samples >= BASELINE_LEARN_SAMPLES; }
+
+    // Significant deviation from the baseline, with confirmation
+    bool presence() const { return _presence; }
+
+    // Baseline distance and mean absolute deviation (mm)
+    uint16_t mean() const { return _mean >> FRACTION_BITS; }
+    uint16_t deviation() const { return _deviation >> FRACTION_BITS; }
+
+    // Learned and drifted by BASELINE_SAVE_MM since the last save or load
+    bool stale() const;
+
+    /**
+     * Restore baselines saved by save(), if the record is intact and was
+     * written for as many sensors
+     * @return false if nothing was restored (learning from scratch)
+     */
+    static bool load(RoomBaseline *baselines, uint8_t count);
+
+    /**
+     * Store baselines in EEPROM (blocks a few ms per changed byte, only
+     * the changed bytes are written)
+     */
+    static void save(RoomBaseline *baselines, uint8_t count);
+
+private:
+    static const uint8_t FRACTION_BITS = 4;
+
+    uint16_t _mean;
+    uint16_t _deviation;
+    uint16_t _saved_mean; // Q12.4, 0 if never saved
+    uint8_t _samples;     // Saturates at BASELINE_LEARN_SAMPLES
+    uint8_t _streak;      // Samples in a row contradicting the presence state
+    bool _presence;
+};
+
+#endif // BASELINE_H
@@ -0,0 +1,82 @@
+#include "distance_filter.h"
+#include <string.h>
+
+#if !(FILTER_MEDIAN_N & 1) || FILTER_MEDIAN_N > 9
+#error "FILTER_MEDIAN_N must be odd and no larger than 9"
+#endif
+
+DistanceFilter::DistanceFilter(uint16_t period_ms)
+{
+    setPeriod(period_ms);
+    reset();
+}
+
+void DistanceFilter::setPeriod(uint16_t period_ms)
+{
+    if (period_ms == 0)
+        period_ms = 1;
+    uint32_t scale = (1000UL << 8) / period_ms;
+    _speed_scale = scale > 0xFFFF ? 0xFFFF : scale;
+}
+
+void DistanceFilter::reset()
+{
+    memset(_window, 0, sizeof(_window));
+    _index = 0;
+    _count = 0;
+    _ewma = 0;
+    _previous = 0;
+    _speed = 0;
+    _motion = false;
+}
+
+uint16_t DistanceFilter::update(uint16_t distance_mm)
+{
+    if (distance_mm == 0 || distance_mm > FILTER_NO_ECHO_MM)
+        distance_mm = FILTER_NO_ECHO_MM;
+
+    _window[_index] = distance_mm;
+    _index = (_index + 1) % FILTER_MEDIAN_N;
+    if (_count < FILTER_MEDIAN_N)
+        _count++;
+
+    // Median of the samples so far: insertion sort of a copy
+    uint16_t sorted[FILTER_MEDIAN_N];
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        uint16_t value = _window[i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = value;
+    }
+    uint16_t median = sorted[_count / 2];
+
+    if (_count == 1)
+    {
+        // First sample: no history to smooth or compare against
+        _ewma = median << FILTER_FRACTION_BITS;
+        _previous = _ewma;
+        return distance();
+    }
+
+    // EWMA on the fixed-point state, arithmetic shift of the signed step
+    int32_t step = ((int32_t)median << FILTER_FRACTION_BITS) - _ewma;
+    _ewma += step >> FILTER_EWMA_SHIFT;
+
+    // Speed of the smoothed distance: |delta| per sample, scaled to mm/s
+    uint16_t delta = _ewma > _previous ? _ewma - _previous : _previous - _ewma;
+    _previous = _ewma;
+    uint32_t speed = ((uint32_t)delta * _speed_scale) >> (8 + FILTER_FRACTION_BITS);
+    if (speed > 0xFFFF)
+        speed = 0xFFFF;
+    int32_t average_step = (int32_t)speed - _speed;
+    _speed += average_step >> MOTION_SPEED_SHIFT;
+
+    if (!_motion && _speed >= MOTION_ON_MM_S)
+        _motion = true;
+    else if (_motion && _speed <= MOTION_OFF_MM_S)
+        _motion = false;
+
+    return distance();
+}
@@ -0,0 +1,88 @@
+#ifndef DISTANCE_FILTER_H
+#define DISTANCE_FILTER_H
+
+#include <inttypes.h>
+
+// Spike rejection: median of the last N raw samples (odd, small)
+#ifndef FILTER_MEDIAN_N
+#define FILTER_MEDIAN_N 5
+#endif
+
+// Smoothing: EWMA with alpha = 1 / 2^FILTER_EWMA_SHIFT
+#ifndef FILTER_EWMA_SHIFT
+#define FILTER_EWMA_SHIFT 2
+#endif
+
+// Motion: speed of the smoothed distance (mm/s), averaged with
+// alpha = 1 / 2^MOTION_SPEED_SHIFT, against two thresholds (hysteresis)
+#ifndef MOTION_SPEED_SHIFT
+#define MOTION_SPEED_SHIFT 1
+#endif
+#ifndef MOTION_ON_MM_S
+#define MOTION_ON_MM_S 250
+#endif
+#ifndef MOTION_OFF_MM_S
+#define MOTION_OFF_MM_S 80
+#endif
+
+// Distance used when no echo came back (0 from the driver)
+#ifndef FILTER_NO_ECHO_MM
+#define FILTER_NO_ECHO_MM 4000
+#endif
+
+/*
+ * Integer-only filtering stage between the ultrasonic driver and the
+ * registers: median-of-N spike rejection, EWMA smoothing, then a motion
+ * detector on the rate of change of the smoothed distance. A single
+ * spurious echo is dropped by the median, and motion is detected at any
+ * distance, not only under a fixed threshold.
+ */
+class DistanceFilter {
+public:
+    /**
+     * @param period_ms Time between two samples
+     */
+    DistanceFilter(uint16_t period_ms = 100);
+
+    /**
+     * Change the time between two samples, the speed scale is recomputed
+     * here (the only division of the filter)
+     */
+    void setPeriod(uint16_t period_ms);
+
+    /**
+     * Start over, e.g. after a long pause in the sampling
+     */
+    void reset();
+
+    /**
+     * Feed a raw sample
+     * @param distance_mm Distance measured, 0 if no echo
+     * @return Smoothed distance (mm)
+     */
+    uint16_t update(uint16_t distance_mm);
+
+    // Smoothed distance (mm)
+    uint16_t distance() const { return _ewma >> FILTER_FRACTION_BITS; }
+
+    // Averaged speed of the smoothed distance (mm/s, unsigned)
+    uint16_t speed() const { return _speed; }
+
+    // Motion state, with hysteresis
+    bool motion() const { return _motion; }
+
+private:
+    // Fractional bits of the EWMA state (Q12.4, up to 4095mm)
+    static const uint8_t FILTER_FRACTION_BITS = 4;
+
+    uint16_t _window[FILTER_MEDIAN_N];
+    uint8_t _index;
+    uint8_t _count;
+    uint16_t _ewma;
+    uint16_t _previous;
+    uint16_t _speed;
+    uint16_t _speed_scale; // 1000 / period, Q8.8
+    bool _motion;
+};
+
+#endif // DISTANCE_FILTER_H
@@ -12,6 +12,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include "ultrasonic.h"
+#include "../timebase/timebase.h"
+#include "../pcint/pcint.h"
 
 // Helper macros for pin manipulation
 #define SET_OUTPUT(port, pin) DDR ## port |= (1 << pin)
@@ -20,11 +22,18 @@
 #define SET_LOW(port, pin) PORT ## port &= ~(1 << pin)
 #define READ_PIN(port, pin) (PIN ## port & (1 << pin))
 
-// Microsecond timer functions (assumes 16MHz clock)
-static inline uint32_t micros() {
-    // This is a simplified version - you may need to implement a proper timer
-    // For accurate timing, use Timer0 or Timer1 with overflow interrupts
-    return (TCNT1 * 4); // Assumes Timer1 with prescaler 64: (64/16MHz) * 1000000 = 4
+// Echo (us) to distance conversions, multiply by a 16.16 reciprocal
+// instead of a 32-bit division: 29us/cm round trip, 74us/in
+constexpr uint32_t reciprocal(uint32_t num, uint32_t den) {
+    return ((num << 16) + den / 2) / den;
+}
+#define ECHO_MAX_US 0xFFFFUL // ~11m, keeps the products within 32 bits
+
+static uint16_t echoTo(uint32_t echo, uint32_t factor) {
+    if (echo > ECHO_MAX_US) {
+        echo = ECHO_MAX_US;
+    }
+    return (echo * factor) >> 16;
 }
 
 static void delayMicroseconds(uint16_t us) {
@@ -33,36 +42,17 @@ static void delayMicroseconds(uint16_t us) {
     }
 }
 
-static uint32_t pulseIn(volatile uint8_t *port_reg, volatile uint8_t *pin_reg, 
-                        uint8_t pin_mask, uint8_t state, uint32_t timeout) {
-    uint32_t begin = micros();
-    uint32_t pulse_start, pulse_end;
-    
-    // Wait for any previous pulse to end
-    while ((*pin_reg & pin_mask) == state) {
-        if ((micros() - begin) >= timeout) {
-            return 0;
-        }
-    }
-    
-    // Wait for the pulse to start
-    while ((*pin_reg & pin_mask) != state) {
-        if ((micros() - begin) >= timeout) {
-            return 0;
-        }
-    }
-    pulse_start = micros();
-    
-    // Wait for the pulse to stop
-    while ((*pin_reg & pin_mask) == state) {
-        if ((micros() - begin) >= timeout) {
-            return 0;
-        }
-    }
-    pulse_end = micros();
-    
-    return pulse_end - pulse_start;
-}
+// Sensors dispatched by the interrupts, several may measure at once
+static Ultrasonic *g_sensors[ULTRASONIC_MAX_SENSORS];
+static uint8_t g_sensor_count = 0;
+static uint8_t g_attached_banks = 0;
+
+// Measurement steps (Ultrasonic::_state)
+#define STATE_IDLE      0
+#define STATE_TRIGGER   1  // Claimed, trigger pulse being sent
+#define STATE_WAIT_RISE 2
+#define STATE_WAIT_FALL 3
+#define STATE_DETACHED  4  // Over ULTRASONIC_MAX_SENSORS, never measures
 
 Ultrasonic::Ultrasonic(volatile uint8_t *port, volatile uint8_t *ddr, 
                        volatile uint8_t *pin_reg, uint8_t pin_num) {
@@ -70,9 +60,95 @@ Ultrasonic::Ultrasonic(volatile uint8_t *port, volatile uint8_t *ddr,
     _ddr = ddr;
     _pin_reg = pin_reg;
     _pin_mask = (1 << pin_num);
+    _bank = PinChange::bankOf(pin_reg);
+    _task = NULL;
+    _callback = NULL;
+    _echo = 0;
+    _distance = 0;
+    _start = 0;
+    _state = STATE_DETACHED;
+
+    portENTER_CRITICAL();
+    if (g_sensor_count < ULTRASONIC_MAX_SENSORS) {
+        g_sensors[g_sensor_count++] = this;
+        _state = STATE_IDLE;
+    }
+    portEXIT_CRITICAL();
+
+    // One handler per bank serves all the sensors wired to it
+    if (!(g_attached_banks & _BV(_bank))) {
+        g_attached_banks |= _BV(_bank);
+        PinChange::attach(_bank, _onPinChange);
+    }
+    Timebase::setTickCallback(_onTick);
 }
 
-long Ultrasonic::duration(uint32_t timeout) {
+// End of the measurement (interrupt context)
+void Ultrasonic::_complete(uint32_t echo, bool yield) {
+    _state = STATE_IDLE;
+    PinChange::disable(_bank, _pin_mask);
+    _echo = echo;
+    _distance = echoTo(echo, reciprocal(10, 2 * 29));
+
+    if (_callback != NULL) {
+        _callback(this, _distance, _start);
+        return;
+    }
+
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_task, &xHigherPriorityTaskWoken);
+    if (yield && xHigherPriorityTaskWoken) taskYIELD();
+}
+
+// Pin change interrupt: timestamp the rising edge, then the falling one
+// and complete. The sensors of the changed bank are not told apart, the
+// level of each pin is enough
+void Ultrasonic::_onPinChange() {
+    uint32_t now = Timebase::micros();
+    for (uint8_t i = 0; i < g_sensor_count; i++) {
+        Ultrasonic *sensor = g_sensors[i];
+        uint8_t high = *sensor->_pin_reg & sensor->_pin_mask;
+        if (sensor->_state == STATE_WAIT_RISE) {
+            if (high) {
+                sensor->_rise = now;
+                sensor->_state = STATE_WAIT_FALL;
+            }
+        } else if (sensor->_state == STATE_WAIT_FALL && !high) {
+            sensor->_complete(now - sensor->_rise, true);
+        }
+    }
+}
+
+// Tick interrupt: give up on a missing echo. The tick switches tasks
+// itself, so no yield here
+void Ultrasonic::_onTick() {
+    uint32_t now = Timebase::micros();
+    for (uint8_t i = 0; i < g_sensor_count; i++) {
+        Ultrasonic *sensor = g_sensors[i];
+        uint8_t state = sensor->_state;
+        if ((state == STATE_WAIT_RISE || state == STATE_WAIT_FALL) &&
+            now - sensor->_start >= sensor->_timeout) {
+            sensor->_complete(0, false);
+        }
+    }
+}
+
+bool Ultrasonic::start(UltrasonicCallback callback, uint32_t timeout) {
+    portENTER_CRITICAL();
+    if (_state != STATE_IDLE) {
+        portEXIT_CRITICAL();
+        return false;
+    }
+    _state = STATE_TRIGGER; // Claimed, ignored by the interrupts until triggered
+    portEXIT_CRITICAL();
+
+    _callback = callback;
+    _timeout = timeout;
+    if (callback == NULL) {
+        _task = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0); // Drop a stale wake-up
+    }
+
     // Set pin as output
     *_ddr |= _pin_mask;
     
@@ -83,31 +159,65 @@ long Ultrasonic::duration(uint32_t timeout) {
     delayMicroseconds(5);
     *_port &= ~_pin_mask;  // LOW
     
-    // Set pin as input
+    // Set pin as input, the edges are timed by the pin change interrupt
     *_ddr &= ~_pin_mask;
-    
-    // Measure pulse duration
-    long dur = pulseIn(_port, _pin_reg, _pin_mask, _pin_mask, timeout);
-    return dur;
+    _start = Timebase::micros();
+    _state = STATE_WAIT_RISE;
+    PinChange::enable(_bank, _pin_mask);
+    return true;
+}
+
+bool Ultrasonic::busy() const {
+    uint8_t state = _state;
+    return state != STATE_IDLE && state != STATE_DETACHED;
+}
+
+uint16_t Ultrasonic::lastDistance(uint32_t *timestamp) const {
+    portENTER_CRITICAL();
+    uint16_t distance = _distance;
+    if (timestamp != NULL) {
+        *timestamp = _start;
+    }
+    portEXIT_CRITICAL();
+    return distance;
+}
+
+long Ultrasonic::duration(uint32_t timeout) {
+    if (!start(NULL, timeout)) {
+        return 0;
+    }
+
+    // Sleep until the echo or the timeout (tick interrupt), other tasks
+    // run meanwhile. The wait itself is only a safety net
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((timeout + 999) / 1000) + 2) == 0) {
+        portENTER_CRITICAL();
+        if (busy()) {
+            PinChange::disable(_bank, _pin_mask);
+            _state = STATE_IDLE;
+            _echo = 0;
+        }
+        portEXIT_CRITICAL();
+    }
+    return _echo;
 }
 
 /*The measured distance from the range 0 to 400 Centimeters*/
 long Ultrasonic::MeasureInCentimeters(uint32_t timeout) {
     long RangeInCentimeters;
-    RangeInCentimeters = duration(timeout) / 29 / 2;
+    RangeInCentimeters = echoTo(duration(timeout), reciprocal(1, 2 * 29));
     return RangeInCentimeters;
 }
 
 /*The measured distance from the range 0 to 4000 Millimeters*/
 long Ultrasonic::MeasureInMillimeters(uint32_t timeout) {
     long RangeInMillimeters;
-    RangeInMillimeters = duration(timeout) * (10 / 2) / 29;
+    RangeInMillimeters = echoTo(duration(timeout), reciprocal(10, 2 * 29));
     return RangeInMillimeters;
 }
 
 /*The measured distance from the range 0 to 157 Inches*/
 long Ultrasonic::MeasureInInches(uint32_t timeout) {
     long RangeInInches;
-    RangeInInches = duration(timeout) / 74 / 2;
+    RangeInInches = echoTo(duration(timeout), reciprocal(1, 2 * 74));
     return RangeInInches;
 }
@@ -8,6 +8,33 @@
 
 #include <avr/io.h>
 #include <inttypes.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Farthest distance measured, the echo is not waited for any longer
+#ifndef ULTRASONIC_MAX_RANGE_MM
+#define ULTRASONIC_MAX_RANGE_MM 4000
+#endif
+
+// Echo duration at the maximum range (29us/cm round trip, see
+// MeasureInMillimeters), plus the burst sent before the echo starts
+#define ULTRASONIC_TIMEOUT_US ((uint32_t)ULTRASONIC_MAX_RANGE_MM * 29 / 5 + 1000)
+
+// Shortest measurement cycle, lets the echoes of the previous burst die out
+#define ULTRASONIC_MIN_PERIOD_MS 60
+
+// Sensors served by the interrupts, the extra ones never measure
+#ifndef ULTRASONIC_MAX_SENSORS
+#define ULTRASONIC_MAX_SENSORS 4
+#endif
+
+class Ultrasonic;
+
+// Completion of an asynchronous measurement, called from an interrupt (pin
+// change, or the tick on timeout): keep it short and use the FromISR API.
+// distance_mm is 0 if no echo came back, timestamp is the Timebase::micros()
+// of the trigger pulse
+typedef void (*UltrasonicCallback)(Ultrasonic *sensor, uint16_t distance_mm, uint32_t timestamp);
 
 class Ultrasonic {
 public:
@@ -16,16 +43,50 @@ public:
     Ultrasonic(volatile uint8_t *port, volatile uint8_t *ddr, 
                volatile uint8_t *pin_reg, uint8_t pin_num);
     
-    long duration(uint32_t timeout = 1000000L);
-    long MeasureInCentimeters(uint32_t timeout = 1000000L);
-    long MeasureInMillimeters(uint32_t timeout = 1000000L);
-    long MeasureInInches(uint32_t timeout = 1000000L);
+    // The echo edges are timestamped by the pin change interrupt while the
+    // calling task is blocked, up to timeout (us). 0 if no echo came back
+    long duration(uint32_t timeout = ULTRASONIC_TIMEOUT_US);
+    long MeasureInCentimeters(uint32_t timeout = ULTRASONIC_TIMEOUT_US);
+    long MeasureInMillimeters(uint32_t timeout = ULTRASONIC_TIMEOUT_US);
+    long MeasureInInches(uint32_t timeout = ULTRASONIC_TIMEOUT_US);
+
+    // Asynchronous measurement: fire the trigger pulse and return at once.
+    // On completion the callback is called or, without one, the calling
+    // task is notified (ulTaskNotifyTake, pending notifications of that
+    // task are cleared first). One measurement at a time per sensor; the
+    // sensors may measure together, keeping them from hearing each other
+    // is up to the caller (see UltrasonicScheduler). The callback may start
+    // the next one to chain them back to back.
+    // Returns false if this sensor is already measuring
+    bool start(UltrasonicCallback callback = NULL, uint32_t timeout = ULTRASONIC_TIMEOUT_US);
+
+    // A measurement started by start() has not completed yet
+    bool busy() const;
+
+    // Last completed measurement: distance in mm (0 if no echo), and the
+    // trigger timestamp if requested
+    uint16_t lastDistance(uint32_t *timestamp = NULL) const;
 
 private:
     volatile uint8_t *_port;
     volatile uint8_t *_ddr;
     volatile uint8_t *_pin_reg;
     uint8_t _pin_mask;
+    uint8_t _bank;
+
+    // Measurement in progress, written by the interrupts
+    TaskHandle_t _task;
+    UltrasonicCallback _callback;
+    uint32_t _timeout;
+    volatile uint32_t _start;
+    volatile uint8_t _state;
+    volatile uint32_t _rise;
+    volatile uint32_t _echo;
+    volatile uint16_t _distance;
+
+    void _complete(uint32_t echo, bool yield);
+    static void _onPinChange();
+    static void _onTick();
 };
 
 #endif // ULTRASONIC_AVR_H
@@ -0,0 +1,64 @@
+#include "ultrasonic_scheduler.h"
+
+// Task blocked in measure(), notified once per completed sensor
+static TaskHandle_t g_waiting_task = NULL;
+
+UltrasonicScheduler::UltrasonicScheduler() {
+    _count = 0;
+    _group_count = 0;
+}
+
+bool UltrasonicScheduler::add(Ultrasonic *sensor, uint8_t group) {
+    if (_count >= ULTRASONIC_MAX_SENSORS) {
+        return false;
+    }
+    _sensors[_count] = sensor;
+    _groups[_count] = group;
+    _count++;
+    if (group >= _group_count) {
+        _group_count = group + 1;
+    }
+    return true;
+}
+
+// Completion of one sensor (interrupt context)
+void UltrasonicScheduler::_onComplete(Ultrasonic *sensor, uint16_t distance_mm, uint32_t timestamp) {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(g_waiting_task, &xHigherPriorityTaskWoken);
+    // No yield: the tick calls this on timeout, the pin change ISR
+    // returns to the waiting task soon enough
+}
+
+void UltrasonicScheduler::measure() {
+    g_waiting_task = xTaskGetCurrentTaskHandle();
+
+    for (uint8_t group = 0; group < _group_count; group++) {
+        TickType_t slot_start = xTaskGetTickCount();
+        ulTaskNotifyTake(pdTRUE, 0); // Drop a stale wake-up
+
+        // Fire the whole group back to back
+        uint8_t pending = 0;
+        for (uint8_t i = 0; i < _count; i++) {
+            if (_groups[i] == group && _sensors[i]->start(_onComplete)) {
+                pending++;
+            }
+        }
+        if (pending == 0) {
+            continue; // Empty group, no slot
+        }
+
+        // One notification per sensor, the timeouts come from the tick
+        while (pending > 0 && ulTaskNotifyTake(pdFALSE, pdMS_TO_TICKS(ULTRASONIC_SLOT_MS)) > 0) {
+            pending--;
+        }
+
+        // Hold the rest of the slot, even on a near echo: the far ones of
+        // this group's bursts are still travelling
+        vTaskDelayUntil(&slot_start, pdMS_TO_TICKS(ULTRASONIC_SLOT_MS));
+    }
+}
+
+uint16_t UltrasonicScheduler::minPeriod() const {
+    uint16_t period_ms = _group_count * ULTRASONIC_SLOT_MS;
+    return period_ms < ULTRASONIC_MIN_PERIOD_MS ? ULTRASONIC_MIN_PERIOD_MS : period_ms;
+}
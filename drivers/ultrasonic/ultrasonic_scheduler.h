@@ -0,0 +1,66 @@
+#ifndef ULTRASONIC_SCHEDULER_H
+#define ULTRASONIC_SCHEDULER_H
+
+#include <inttypes.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "ultrasonic.h"
+
+// Quiet time added after the farthest echo of a group, for the
+// reverberations of its bursts to fade before the next group fires
+#ifndef ULTRASONIC_GUARD_MS
+#define ULTRASONIC_GUARD_MS 6
+#endif
+
+// Time slot of a group: echo at the maximum range, then the guard
+#define ULTRASONIC_SLOT_MS ((ULTRASONIC_TIMEOUT_US + 999) / 1000 + ULTRASONIC_GUARD_MS)
+
+/*
+ * Fires several rangers without crosstalk. Each sensor belongs to a group:
+ * the sensors of a group are triggered together (they must not hear each
+ * other, e.g. facing different doorways), the groups take turns, each in
+ * its own slot. One sensor per group gives plain round-robin; a single
+ * group measures everything at once.
+ *
+ * A cycle lasts one slot per group, so each sensor is updated every
+ * max(groups x ULTRASONIC_SLOT_MS, ULTRASONIC_MIN_PERIOD_MS): put as many
+ * sensors as possible in the same group.
+ */
+class UltrasonicScheduler {
+public:
+    UltrasonicScheduler();
+
+    /**
+     * Add a sensor, its index is the order of the calls
+     * @param sensor Ranger, measured only by this scheduler from now on
+     * @param group Sensors of the same group are fired together, number
+     * the groups from 0 without gaps
+     * @return false if ULTRASONIC_MAX_SENSORS are already scheduled
+     */
+    bool add(Ultrasonic *sensor, uint8_t group);
+
+    // Number of sensors added
+    uint8_t count() const { return _count; }
+
+    // Sensor at an index
+    Ultrasonic *sensor(uint8_t index) const { return _sensors[index]; }
+
+    /**
+     * Measure every sensor once, group after group, blocking the calling
+     * task meanwhile. The results are read with sensor(i)->lastDistance()
+     */
+    void measure();
+
+    // Shortest time between two calls to measure() (ms)
+    uint16_t minPeriod() const;
+
+private:
+    Ultrasonic *_sensors[ULTRASONIC_MAX_SENSORS];
+    uint8_t _groups[ULTRASONIC_MAX_SENSORS];
+    uint8_t _count;
+    uint8_t _group_count; // Highest group + 1
+
+    static void _onComplete(Ultrasonic *sensor, uint16_t distance_mm, uint32_t timestamp);
+};
+
+#endif // ULTRASONIC_SCHEDULER_H
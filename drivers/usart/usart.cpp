@@ -0,0 +1,87 @@
+#include "usart.h"
+#include "../rfid/rfid_transport.h"
+#include <avr/interrupt.h>
+
+// Only linked in when it carries the RFID reader: the receive vector
+// would be taken (and HardwareSerial ruled out) even if unused
+#if RFID_TRANSPORT == RFID_USART
+
+#if (USART_RX_BUFFER_SIZE & (USART_RX_BUFFER_SIZE - 1)) || USART_RX_BUFFER_SIZE > 128
+#error "USART_RX_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+static volatile uint8_t g_rx[USART_RX_BUFFER_SIZE];
+static volatile uint8_t g_rx_head = 0; // Next byte read
+static volatile uint8_t g_rx_tail = 0; // Next byte stored
+static volatile uint8_t g_errors = 0;
+static UsartReceiveHandler g_handler = NULL;
+
+static void countError()
+{
+    if (g_errors < 0xFF)
+        g_errors++;
+}
+
+void Usart::begin(long baudRate)
+{
+    // Double speed: finer baud rate steps (0.2% error at 9600 baud)
+    UBRR0 = ((F_CPU / 4 / baudRate) - 1) / 2;
+    UCSR0A = _BV(U2X0);
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+    UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+}
+
+int Usart::available()
+{
+    return (uint8_t)(g_rx_tail - g_rx_head) & (USART_RX_BUFFER_SIZE - 1);
+}
+
+int Usart::read()
+{
+    uint8_t head = g_rx_head;
+    if (head == g_rx_tail)
+        return -1;
+    uint8_t byte = g_rx[head];
+    g_rx_head = (head + 1) & (USART_RX_BUFFER_SIZE - 1);
+    return byte;
+}
+
+size_t Usart::write(uint8_t byte)
+{
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = byte;
+    return 1;
+}
+
+void Usart::setReceiveHandler(UsartReceiveHandler handler)
+{
+    g_handler = handler;
+}
+
+uint8_t Usart::errors()
+{
+    return g_errors;
+}
+
+ISR(USART_RX_vect)
+{
+    // Status before data: reading UDR0 pops the flags of the byte
+    uint8_t status = UCSR0A;
+    uint8_t byte = UDR0;
+
+    uint8_t next = (g_rx_tail + 1) & (USART_RX_BUFFER_SIZE - 1);
+    if (status & _BV(DOR0))
+        countError(); // A byte before this one was lost
+    if ((status & _BV(FE0)) || next == g_rx_head)
+    {
+        countError(); // Garbled byte, or no room
+        return;
+    }
+    g_rx[g_rx_tail] = byte;
+    g_rx_tail = next;
+
+    if (g_handler != NULL)
+        g_handler();
+}
+
+#endif // RFID_TRANSPORT == RFID_USART
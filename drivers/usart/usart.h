@@ -0,0 +1,42 @@
+#ifndef USART_H
+#define USART_H
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+// Bytes received ahead of the reader (power of two)
+#ifndef USART_RX_BUFFER_SIZE
+#define USART_RX_BUFFER_SIZE 16
+#endif
+
+// Called from the receive interrupt after each byte is stored
+typedef void (*UsartReceiveHandler)(void);
+
+/*
+ * Hardware USART0 (RX on D0, TX on D1), 8N1. Reception is interrupt
+ * driven: the frame is shifted in by the hardware and the interrupt only
+ * stores the byte, so no other interrupt waits for a whole character as
+ * with SoftwareSerial. Transmission is polled. Same read interface as
+ * SoftwareSerial so the drivers can use either. Only built in with
+ * RFID_TRANSPORT == RFID_USART (rfid_transport.h).
+ */
+class Usart {
+public:
+    static void begin(long baudRate);
+    static int available();
+
+    // Oldest byte received, -1 if none
+    static int read();
+
+    // Blocks while the previous byte is being sent
+    static size_t write(uint8_t byte);
+
+    // Called in the receive interrupt, e.g. to parse as the bytes arrive
+    static void setReceiveHandler(UsartReceiveHandler handler);
+
+    // Bytes lost: hardware overrun, framing error or full buffer
+    static uint8_t errors();
+};
+
+#endif // USART_H
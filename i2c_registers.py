@@ -0,0 +1,85 @@
+# Generated from drivers/i2c/i2c_registers.h by `make i2c_registers.py`, do not edit
+
+NUM_REGISTERS = 80
+
+REG_STATUS           = 0x00  # General system status
+REG_ALARM_STATE      = 0x01  # Alarm state (0=off, 1=on)
+REG_MOTION_DETECTED  = 0x02  # Motion detected by any sensor (0=no, 1=yes)
+REG_BUZZER_CMD       = 0x03  # Buzzer command (0=off, 1=on)
+REG_LED_CMD          = 0x04  # LED command (0=off, 1=on)
+REG_DISTANCE         = 0x05  # Ultrasonic distance of sensor 0 (mm)
+REG_RFID_STATUS      = 0x07  # RFID status (0=no tag, 1=tag present)
+REG_RFID_ID          = 0x08  # RFID tag ID (8 ASCII characters)
+REG_ROTARY_ANGLE     = 0x10  # Potentiometer angle
+REG_BUTTON_STATE     = 0x11  # Button state (0=released, 1=pressed)
+REG_COMMAND          = 0x12  # General command register
+REG_ERROR_CODE       = 0x13  # Error code (ERR_*, write 0 to clear)
+REG_EVENT_COUNT      = 0x14  # Number of events pending in the FIFO
+REG_EVENT_OVERFLOW   = 0x15  # Events lost on a full FIFO (write 0 to clear)
+REG_EVENT_FIFO       = 0x16  # Event FIFO window (see event_fifo.h)
+REG_ATTN_CONFIG      = 0x17  # Attention line sources (ATTN_ON_* bits)
+REG_ISR_TIME         = 0x18  # Worst-case TWI interrupt time, 4us units (write 0 to reset)
+REG_CMD_ACK          = 0x19  # Last command frame handled: sequence number (MSB), CMD_* status (LSB)
+REG_CMD_NACK         = 0x1B  # Last command frame rejected: sequence number (MSB), CMD_* status (LSB)
+REG_SAMPLE_SLOW      = 0x1D  # Ultrasonic period when disarmed and quiet, 10ms units
+REG_SAMPLE_FAST      = 0x1E  # Ultrasonic period when armed or after motion, 10ms units
+REG_SAMPLE_HOLD      = 0x1F  # Time the fast period is kept after the last motion, seconds
+REG_MAILBOX          = 0x20  # Command frame window (see I2C_Protocol::_onWriteBegin)
+REG_SENSOR_DISTANCE  = 0x30  # Distance of each ultrasonic sensor (mm), 4 x 16 bits, 0 if absent
+REG_SENSOR_MOTION    = 0x38  # Motion of each ultrasonic sensor (bit n = sensor n)
+REG_PRESENCE         = 0x39  # Presence against the room baseline (bit n = sensor n)
+REG_BASELINE         = 0x3A  # Sensors with a learned room baseline (bit n), write 0 to learn again
+REG_HISTORY          = 0x3B  # Distance history window (see distance_history.h)
+REG_HISTORY_SOURCE   = 0x3C  # Sensor recorded in the history, 0xFF = none
+REG_ALLOWLIST        = 0x3D  # Badges in the local allow-list (synced by data frames, see allow_list.h)
+REG_RFID_HOLDOFF     = 0x3E  # Repeats of a badge ignored until it is gone this long, 100ms units
+REG_RFID_CARD        = 0x3F  # RFID tag ID, binary: version byte then card number, big-endian (the allow-list key)
+REG_HEAP_FREE        = 0x44  # Heap left once the tasks are created, bytes (255 = 255 or more)
+REG_STACK_MARGIN     = 0x45  # Smallest stack margin of the tasks so far, bytes (255 = 255 or more)
+REG_DIRTY            = 0x46  # Changed-register bitmap, little-endian (bit n = register n)
+
+# Offset -> (name, width in bytes, master access)
+REGISTERS = {
+    0x00: ("STATUS", 1, "ro"),
+    0x01: ("ALARM_STATE", 1, "rw"),
+    0x02: ("MOTION_DETECTED", 1, "ro"),
+    0x03: ("BUZZER_CMD", 1, "rw"),
+    0x04: ("LED_CMD", 1, "rw"),
+    0x05: ("DISTANCE", 2, "ro"),
+    0x07: ("RFID_STATUS", 1, "ro"),
+    0x08: ("RFID_ID", 8, "ro"),
+    0x10: ("ROTARY_ANGLE", 1, "ro"),
+    0x11: ("BUTTON_STATE", 1, "ro"),
+    0x12: ("COMMAND", 1, "rw"),
+    0x13: ("ERROR_CODE", 1, "rw"),
+    0x14: ("EVENT_COUNT", 1, "ro"),
+    0x15: ("EVENT_OVERFLOW", 1, "rw"),
+    0x16: ("EVENT_FIFO", 1, "ro"),
+    0x17: ("ATTN_CONFIG", 1, "rw"),
+    0x18: ("ISR_TIME", 1, "rw"),
+    0x19: ("CMD_ACK", 2, "ro"),
+    0x1B: ("CMD_NACK", 2, "ro"),
+    0x1D: ("SAMPLE_SLOW", 1, "rw"),
+    0x1E: ("SAMPLE_FAST", 1, "rw"),
+    0x1F: ("SAMPLE_HOLD", 1, "rw"),
+    0x20: ("MAILBOX", 16, "wo"),
+    0x30: ("SENSOR_DISTANCE", 8, "ro"),
+    0x38: ("SENSOR_MOTION", 1, "ro"),
+    0x39: ("PRESENCE", 1, "ro"),
+    0x3A: ("BASELINE", 1, "rw"),
+    0x3B: ("HISTORY", 1, "ro"),
+    0x3C: ("HISTORY_SOURCE", 1, "rw"),
+    0x3D: ("ALLOWLIST", 1, "ro"),
+    0x3E: ("RFID_HOLDOFF", 1, "rw"),
+    0x3F: ("RFID_CARD", 5, "ro"),
+    0x44: ("HEAP_FREE", 1, "ro"),
+    0x45: ("STACK_MARGIN", 1, "ro"),
+    0x46: ("DIRTY", 10, "rc"),
+}
+
+
+def decode(bank, reg, base=0):
+    """Value of register reg out of bytes read from offset base on
+    (multi-byte registers are big-endian)"""
+    width = REGISTERS[reg][1]
+    return int.from_bytes(bytes(bank[reg - base:reg - base + width]), "big")
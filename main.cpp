@@ -1,14 +1,23 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include <avr/io.h>
-#include <Wire.h>
+#include <stdlib.h>
 #include "drivers/lcd/lcd.h"
 #include "drivers/rfid/rfid.h"
+#include "drivers/rfid/allow_list.h"
+#include "drivers/rfid/tag_dedup.h"
 #include "drivers/buzzer/buzzer.h"
 #include "drivers/ultrasonic/ultrasonic.h"
+#include "drivers/ultrasonic/distance_filter.h"
+#include "drivers/ultrasonic/ultrasonic_scheduler.h"
+#include "drivers/ultrasonic/baseline.h"
 #include "drivers/button/button.h"
 #include "drivers/rotary_angle/rotary_angle.h"
 #include "drivers/i2c/i2c.h"
+#include "drivers/i2c/event_fifo.h"
+#include "drivers/i2c/distance_history.h"
+#include "drivers/timebase/timebase.h"
+#include "drivers/eeprom/eeprom_lock.h"
 
 // Tasks
 static void vReadRfid(void *pvParameters);
@@ -16,16 +25,39 @@ static void vBuzzerTask(void *pvParameters);
 static void vUltrasonicTask(void *pvParameters);
 static void vRotaryAngleTask(void *pvParameters);
 static void vI2CUpdateTask(void *pvParameters);
+#ifdef LCD_BENCHMARK
+static void vLcdBenchmarkTask(void *pvParameters);
+#endif
 
 // Peripherals
 static RFID_Reader rfid(7, 8);
+static TagDedup recentTags;
 static Buzzer grooveBuzzer(&DDRD, &PORTD, _BV(PD6));
 static Buzzer led(&DDRD, &PORTD, _BV(PD5));
 static Button myButton(2);
 static RotaryAngle rotaryAngle(0);
-static uint8_t buffer[16];
+
+// Ultrasonic rangers, one per doorway, added to the scheduler in main()
+// with their group. Only rangers that cannot hear each other may share a
+// group; each extra group lengthens the cycle by ULTRASONIC_SLOT_MS
+#define RANGER_COUNT 1
+static Ultrasonic doorRanger(&PORTD, &DDRD, &PIND, PD4);
+static UltrasonicScheduler rangers;
+static DistanceFilter rangerFilters[RANGER_COUNT];
+static RoomBaseline rangerBaselines[RANGER_COUNT];
+static_assert(RANGER_COUNT <= ULTRASONIC_MAX_SENSORS && RANGER_COUNT <= BASELINE_MAX_SENSORS &&
+              RANGER_COUNT * 2 <= i2cRegisterWidth(REG_SENSOR_DISTANCE),
+              "More rangers than the scheduler, the EEPROM or the registers hold");
+
+// Set by the master (REG_BASELINE = 0), the ultrasonic task learns the
+// room again
+static volatile bool g_relearnBaseline = false;
+
+// Checked by reportMemory() along with the idle and I2C command tasks
+static TaskHandle_t g_rfidTask = NULL;
 
 // I2C callbacks to react to commands from the Raspberry Pi
+// (run from the I2C command task, see I2C_COMMAND_QUEUE)
 void onBuzzerCommand(uint8_t reg, uint8_t value) {
     if (value) {
         grooveBuzzer.on();
@@ -44,7 +76,8 @@ void onLedCommand(uint8_t reg, uint8_t value) {
 
 void onAlarmCommand(uint8_t reg, uint8_t value) {
     // Update alarm state
-    I2C_Protocol::setRegister(REG_ALARM_STATE, value);
+    I2C_Protocol::set<REG_ALARM_STATE>(value);
+    EventFifo::push(EVENT_ALARM_CHANGE, value);
 }
 
 void onI2CCommand(uint8_t reg, uint8_t value) {
@@ -59,20 +92,55 @@ void onI2CCommand(uint8_t reg, uint8_t value) {
     case REG_ALARM_STATE:
         onAlarmCommand(reg, value);
         break;
+    case REG_BASELINE:
+        if (value == 0) {
+            g_relearnBaseline = true;
+        }
+        break;
     default:
         break;
     }
 }
 
+// Data frames from the Raspberry Pi (I2C command task only)
+uint8_t onI2CData(uint8_t reg, const uint8_t *data, uint8_t len) {
+    switch (reg)
+    {
+    case REG_ALLOWLIST: {
+        uint8_t status = AllowList::sync(data, len);
+        I2C_Protocol::set<REG_ALLOWLIST>(AllowList::count());
+        return status;
+    }
+    default:
+        return CMD_DENIED;
+    }
+}
+
 int main(void) {
-    // Initialize Wire (required before I2C_Protocol)
-    Wire.begin();
-    
     // Initialize I2C in slave mode (address 0x32)
     I2C_Protocol::init(0x32);
     
     // Register callbacks for commands coming from the Raspberry Pi
     I2C_Protocol::registerCallback(onI2CCommand);
+    I2C_Protocol::registerDataCallback(onI2CData);
+    
+    // Badges allowed to disarm without the Raspberry Pi; the tasks share
+    // the EEPROM with the room baselines
+    EepromLock::init();
+    AllowList::init();
+    I2C_Protocol::set<REG_ALLOWLIST>(AllowList::count());
+    
+    // Ultrasonic sampling: 1s when disarmed and quiet, sensor maximum
+    // when armed and for 10s after motion
+    I2C_Protocol::set<REG_SAMPLE_SLOW>(100);
+    I2C_Protocol::set<REG_SAMPLE_FAST>(ULTRASONIC_MIN_PERIOD_MS / 10);
+    I2C_Protocol::set<REG_SAMPLE_HOLD>(10);
+    
+    rangers.add(&doorRanger, 0);
+    I2C_Protocol::set<REG_HISTORY_SOURCE>(0);
+    
+    // Badge repeats ignored until it is gone for 2s
+    I2C_Protocol::set<REG_RFID_HOLDOFF>(20);
     
     // Initialize peripherals
     led.init();
@@ -82,9 +150,17 @@ int main(void) {
     rotaryAngle.init();
     
     // Create tasks
-    //xTaskCreate(vReadRfid, "rfid", configMINIMAL_STACK_SIZE + 50, NULL, 2U, NULL);
+    // Badge reads: frame and id on the stack, the message buffer receive,
+    // and on top an interrupt frame (the RFID parser) plus a context save
+    xTaskCreate(vReadRfid, "rfid", configMINIMAL_STACK_SIZE + 100, NULL, 2U, &g_rfidTask);
     //xTaskCreate(vBuzzerTask, "buzzer", configMINIMAL_STACK_SIZE, NULL, 1U, NULL);
-    xTaskCreate(vUltrasonicTask, "ultrasonic", configMINIMAL_STACK_SIZE, NULL, 1U, NULL);
+#ifdef LCD_BENCHMARK
+    // In place of the ultrasonic task: the heap has no room for both
+    // (FreeRTOSConfig.h), and the redraws are timed without its work
+    xTaskCreate(vLcdBenchmarkTask, "lcd_bench", configMINIMAL_STACK_SIZE + 50, NULL, 3U, NULL);
+#else
+    xTaskCreate(vUltrasonicTask, "ultrasonic", configMINIMAL_STACK_SIZE + 50, NULL, 1U, NULL);
+#endif
     //xTaskCreate(vRotaryAngleTask, "rotary", configMINIMAL_STACK_SIZE, NULL, 1U, NULL);
     //xTaskCreate(vI2CUpdateTask, "i2c_update", configMINIMAL_STACK_SIZE, NULL, 1U, NULL);
     
@@ -94,56 +170,206 @@ int main(void) {
     return 0;
 }
 
-// RFID task - reads tags and updates I2C registers
+// The stack and heap sizes are counted by hand (FreeRTOSConfig.h): publish
+// what is actually left, saturated to a register byte
+static void reportMemory(void) {
+    size_t heap = xPortGetFreeHeapSize();
+    UBaseType_t margin = uxTaskGetStackHighWaterMark(NULL);
+    TaskHandle_t tasks[] = { g_rfidTask, xTaskGetIdleTaskHandle() };
+    for (uint8_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+        UBaseType_t task_margin = uxTaskGetStackHighWaterMark(tasks[i]);
+        if (task_margin < margin) {
+            margin = task_margin;
+        }
+    }
+    if (I2C_Protocol::commandStackMargin() < margin) {
+        margin = I2C_Protocol::commandStackMargin();
+    }
+    I2C_Protocol::set<REG_HEAP_FREE>(heap < 0xFF ? heap : 0xFF);
+    I2C_Protocol::set<REG_STACK_MARGIN>(margin);
+}
+
+// Out of heap while creating the tasks, or a task ran past its stack
+// (configCHECK_FOR_STACK_OVERFLOW): stop with the LED on rather than run
+// on corrupted memory. The master sees the Arduino stop answering.
+static void halt(void) {
+    taskDISABLE_INTERRUPTS();
+    led.on();
+    while (1) {
+    }
+}
+
+extern "C" void vApplicationMallocFailedHook(void) {
+    halt();
+}
+
+extern "C" void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName) {
+    halt();
+}
+
+// RFID task - publishes the tags checked by the driver, asleep otherwise
 static void vReadRfid(void *pvParameters) {
-    TickType_t xLastWakeUpTime = xTaskGetTickCount();
-    size_t length;
+    uint8_t frame[RFID_DATA_LENGTH];
     
     while (1) {
-        if (rfid.dataAvailable()) {
-            buffer[0] = '\0';
-            length = rfid.readData(buffer, sizeof(buffer) - 1);
-            
-            if (length >= 10) {
-                // Tag detected
-                I2C_Protocol::setRegister(REG_RFID_STATUS, 1);
-                
-                // Copy the tag ID into the registers (max 8 bytes)
-                for (uint8_t i = 0; i < 8 && (i + 1) < length; i++) {
-                    I2C_Protocol::setRegister(REG_RFID_ID_0 + i, buffer[i + 1]);
-                }
-                
-                vTaskDelayUntil(&xLastWakeUpTime, 2000 / portTICK_PERIOD_MS);
-            }
-        } else {
-            // No tag
-            I2C_Protocol::setRegister(REG_RFID_STATUS, 0);
+        // The status falls back to "no tag" a while after the last one
+        TickType_t timeout = I2C_Protocol::get<REG_RFID_STATUS>() ? 1000 / portTICK_PERIOD_MS : portMAX_DELAY;
+        if (!rfid.waitTag(frame, timeout)) {
+            I2C_Protocol::set<REG_RFID_STATUS>(0);
+            continue;
+        }
+        
+        // The reader repeats the frame while the badge is held
+        uint32_t holdoff_ms = I2C_Protocol::get<REG_RFID_HOLDOFF>() * 100UL;
+        if (!recentTags.accept(frame, Timebase::millis(), holdoff_ms)) {
+            continue;
+        }
+        
+        // Tag detected: publish status and ID together
+        uint8_t id[i2cRegisterWidth(REG_RFID_ID)];
+        uint8_t fingerprint = 0;
+        for (uint8_t i = 0; i < sizeof(id); i++) {
+            id[i] = frame[i];
+            fingerprint ^= id[i];
+        }
+        // The full ID, as the master learns and syncs it
+        uint8_t key[ALLOWLIST_KEY_SIZE];
+        static_assert(sizeof(key) == i2cRegisterWidth(REG_RFID_CARD), "REG_RFID_CARD holds an allow-list key");
+        bool card = AllowList::keyOf(frame, key);
+        
+        I2C_Protocol::beginUpdate();
+        I2C_Protocol::set<REG_RFID_STATUS>(1);
+        I2C_Protocol::setBytes<REG_RFID_ID>(id);
+        if (card) {
+            I2C_Protocol::setBytes<REG_RFID_CARD>(key);
         }
+        I2C_Protocol::commitUpdate();
+        EventFifo::push(EVENT_TAG_READ, fingerprint);
         
-        vTaskDelayUntil(&xLastWakeUpTime, 100 / portTICK_PERIOD_MS);
+        // Known badge: disarm at once, the master only hears about it
+        if (I2C_Protocol::get<REG_ALARM_STATE>() && card && AllowList::contains(key)) {
+            onAlarmCommand(REG_ALARM_STATE, 0);
+        }
     }
 }
 
-// Ultrasonic task - measures distance and detects motion
+// Ultrasonic sampling period: fast while armed or shortly after motion,
+// slow otherwise (tuned by the master through REG_SAMPLE_*), never
+// shorter than a scheduler cycle
+static uint16_t samplingPeriod(uint32_t last_motion_ms) {
+    uint8_t fast = I2C_Protocol::get<REG_ALARM_STATE>() ||
+                   Timebase::millis() - last_motion_ms < I2C_Protocol::get<REG_SAMPLE_HOLD>() * 1000UL;
+    uint16_t period_ms = (fast ? I2C_Protocol::get<REG_SAMPLE_FAST>() : I2C_Protocol::get<REG_SAMPLE_SLOW>()) * 10;
+    uint16_t min_period_ms = rangers.minPeriod();
+    return period_ms < min_period_ms ? min_period_ms : period_ms;
+}
+
+// Ultrasonic task - measures the distances and detects motion
 static void vUltrasonicTask(void *pvParameters) {
-    Ultrasonic ultrasonic(&PORTD, &DDRD, &PIND, PD4);
+    uint32_t last_motion_ms = Timebase::millis();
+    uint16_t period_ms = samplingPeriod(last_motion_ms);
     TickType_t xLastWakeUpTime = xTaskGetTickCount();
+    uint8_t last_motion = 0;
+    uint8_t last_presence = 0;
+    uint32_t last_save_ms = Timebase::millis() - BASELINE_SAVE_INTERVAL_MS; // First save once learned
+    
+    for (uint8_t i = 0; i < RANGER_COUNT; i++) {
+        rangerFilters[i].setPeriod(period_ms);
+    }
+    
+    // Room baseline learned before the last reboot, if any
+    RoomBaseline::load(rangerBaselines, RANGER_COUNT);
     
     while (1) {
-        long distance_mm = ultrasonic.MeasureInMillimeters();
+        rangers.measure();
         
-        // Store distance in 2 registers (16 bits)
-        I2C_Protocol::setRegister(REG_DISTANCE_H, (distance_mm >> 8) & 0xFF);
-        I2C_Protocol::setRegister(REG_DISTANCE_L, distance_mm & 0xFF);
+        if (g_relearnBaseline) {
+            g_relearnBaseline = false;
+            for (uint8_t i = 0; i < RANGER_COUNT; i++) {
+                rangerBaselines[i].reset();
+            }
+        }
         
-        // Motion detection (distance < 1000mm)
-        if (distance_mm < 1000 && distance_mm > 0) {
-            I2C_Protocol::setRegister(REG_MOTION_DETECTED, 1);
-        } else {
-            I2C_Protocol::setRegister(REG_MOTION_DETECTED, 0);
+        // Spike rejection and smoothing, motion from the rate of change,
+        // presence against the room baseline (learned while disarmed and
+        // still)
+        uint8_t armed = I2C_Protocol::get<REG_ALARM_STATE>();
+        uint8_t history_source = I2C_Protocol::get<REG_HISTORY_SOURCE>();
+        uint8_t distances[i2cRegisterWidth(REG_SENSOR_DISTANCE)] = {0};
+        uint8_t motion = 0;
+        uint8_t presence = 0;
+        uint8_t learned = 0;
+        bool stale = false;
+        for (uint8_t i = 0; i < RANGER_COUNT; i++) {
+            uint32_t timestamp_us;
+            uint16_t raw_mm = rangers.sensor(i)->lastDistance(&timestamp_us);
+            if (i == history_source) {
+                // Trigger time in ms: micros() wraps after 71 minutes
+                uint32_t age_ms = (Timebase::micros() - timestamp_us) / 1000;
+                DistanceHistory::push(Timebase::millis() - age_ms, raw_mm);
+            }
+            uint16_t distance_mm = rangerFilters[i].update(raw_mm);
+            distances[2 * i] = distance_mm >> 8;
+            distances[2 * i + 1] = distance_mm;
+            bool moving = rangerFilters[i].motion();
+            if (moving) {
+                motion |= _BV(i);
+            }
+            if (rangerBaselines[i].update(distance_mm, !armed && !moving)) {
+                presence |= _BV(i);
+            }
+            if (rangerBaselines[i].learned()) {
+                learned |= _BV(i);
+            }
+            stale |= rangerBaselines[i].stale();
         }
         
-        vTaskDelayUntil(&xLastWakeUpTime, 200 / portTICK_PERIOD_MS);
+        // Publish the distances with the motion and presence flags, so
+        // the master never reads one without the other
+        I2C_Protocol::beginUpdate();
+        I2C_Protocol::set<REG_DISTANCE>(rangerFilters[0].distance());
+        I2C_Protocol::setBytes<REG_SENSOR_DISTANCE>(distances);
+        I2C_Protocol::set<REG_SENSOR_MOTION>(motion);
+        I2C_Protocol::set<REG_MOTION_DETECTED>(motion != 0);
+        I2C_Protocol::set<REG_PRESENCE>(presence);
+        I2C_Protocol::set<REG_BASELINE>(learned);
+        I2C_Protocol::commitUpdate();
+        
+        if (presence != last_presence) {
+            EventFifo::push(EVENT_PRESENCE, presence);
+            last_presence = presence;
+        }
+        
+        // Keep the learned baseline across reboots, without wearing the
+        // EEPROM out on the drift
+        if (stale && Timebase::millis() - last_save_ms >= BASELINE_SAVE_INTERVAL_MS) {
+            RoomBaseline::save(rangerBaselines, RANGER_COUNT);
+            last_save_ms = Timebase::millis();
+        }
+        
+        // Record the edges of each sensor so a blip between two master
+        // polls is not lost
+        for (uint8_t i = 0; i < RANGER_COUNT; i++) {
+            uint8_t changed = (motion ^ last_motion) & _BV(i);
+            if (changed) {
+                EventFifo::push((motion & _BV(i)) ? EVENT_MOTION_START : EVENT_MOTION_STOP, i);
+            }
+        }
+        last_motion = motion;
+        if (motion) {
+            last_motion_ms = Timebase::millis();
+        }
+        
+        // The filters scale their speed to the period
+        uint16_t next_period_ms = samplingPeriod(last_motion_ms);
+        if (next_period_ms != period_ms) {
+            period_ms = next_period_ms;
+            for (uint8_t i = 0; i < RANGER_COUNT; i++) {
+                rangerFilters[i].setPeriod(period_ms);
+            }
+        }
+        reportMemory();
+        vTaskDelayUntil(&xLastWakeUpTime, period_ms / portTICK_PERIOD_MS);
     }
 }
 
@@ -152,10 +378,12 @@ static void vBuzzerTask(void *pvParameters) {
     while (1) {
         // Wait for the button press
         myButton.waitForPress();
+        EventFifo::push(EVENT_BUTTON_PRESS);
         
         // Toggle alarm state
-        uint8_t current_state = I2C_Protocol::getRegister(REG_ALARM_STATE);
-        I2C_Protocol::setRegister(REG_ALARM_STATE, !current_state);
+        uint8_t current_state = I2C_Protocol::get<REG_ALARM_STATE>();
+        I2C_Protocol::set<REG_ALARM_STATE>(!current_state);
+        EventFifo::push(EVENT_ALARM_CHANGE, !current_state);
         
         // Confirmation beep
         grooveBuzzer.on();
@@ -173,7 +401,7 @@ static void vRotaryAngleTask(void *pvParameters) {
         
         // Store the angle in a register (0-255 for 0-300°)
         uint8_t angle_byte = (angle * 255) / 300;
-        I2C_Protocol::setRegister(REG_ROTARY_ANGLE, angle_byte);
+        I2C_Protocol::set<REG_ROTARY_ANGLE>(angle_byte);
         
         vTaskDelayUntil(&xLastWakeUpTime, 200 / portTICK_PERIOD_MS);
     }
@@ -185,15 +413,15 @@ static void vI2CUpdateTask(void *pvParameters) {
     
     while (1) {
         // Read alarm state
-        uint8_t alarm_state = I2C_Protocol::getRegister(REG_ALARM_STATE);
-        uint8_t motion = I2C_Protocol::getRegister(REG_MOTION_DETECTED);
+        uint8_t alarm_state = I2C_Protocol::get<REG_ALARM_STATE>();
+        uint8_t motion = I2C_Protocol::get<REG_MOTION_DETECTED>();
         
         // If alarm enabled AND motion detected -> trigger buzzer
         if (alarm_state && motion) {
-            I2C_Protocol::setRegister(REG_BUZZER_CMD, 1);
+            I2C_Protocol::set<REG_BUZZER_CMD>(1);
             grooveBuzzer.on();
         } else {
-            I2C_Protocol::setRegister(REG_BUZZER_CMD, 0);
+            I2C_Protocol::set<REG_BUZZER_CMD>(0);
             grooveBuzzer.off();
         }
         
@@ -204,8 +432,41 @@ static void vI2CUpdateTask(void *pvParameters) {
             led.off();
         }
         
-        I2C_Protocol::setRegister(REG_STATUS, 0x01); // System OK
+        I2C_Protocol::set<REG_STATUS>(0x01); // System OK
         
         vTaskDelayUntil(&xLastWakeUpTime, 50 / portTICK_PERIOD_MS);
     }
 }
+
+#ifdef LCD_BENCHMARK
+// Redraw cost of each LCD path, measured once above the other tasks, then
+// shown in turn: path name, transactions and microseconds per redraw
+static void vLcdBenchmarkTask(void *pvParameters) {
+    static const char names[LCD_BENCH_COUNT][17] PROGMEM = {
+        "per char", "row + cursor", "flush", "flush unchanged"};
+    static LCD lcd;
+    LCDBenchResult results[LCD_BENCH_COUNT];
+    char number[11];
+
+    lcd.begin(LCD_COLS, LCD_ROWS, 0);
+    lcd.benchmark(results);
+
+    while (1) {
+        for (uint8_t i = 0; i < LCD_BENCH_COUNT; i++) {
+            lcd.clear();
+            lcd.print_P((const unsigned char *)names[i]);
+            lcd.set_cursor(0, 1);
+            utoa(results[i].transactions, number, 10);
+            lcd.print((const unsigned char *)number);
+            lcd.print((const unsigned char *)" tx ");
+            ultoa(results[i].us, number, 10);
+            lcd.print((const unsigned char *)number);
+            lcd.print((const unsigned char *)" us");
+            lcd.flush();
+            reportMemory();
+
+            vTaskDelay(2000 / portTICK_PERIOD_MS);
+        }
+    }
+}
+#endif
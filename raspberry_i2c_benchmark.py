@@ -0,0 +1,64 @@
+from smbus2 import SMBus, i2c_msg
+import argparse
+import time
+
+# Registres de l'Arduino, générés par `make i2c_registers.py`
+from i2c_registers import REG_STATUS, REG_ISR_TIME, REG_DIRTY
+
+I2C_SLAVE_ADDR = 0x32
+I2C_BUS = 1
+
+BURST_SIZES = [1, 2, 4, 8, 16, REG_DIRTY]
+
+
+def bus_frequency():
+    # Fréquence configurée dans /boot/config.txt (dtparam=i2c_arm_baudrate=...)
+    try:
+        path = f"/sys/class/i2c-adapter/i2c-{I2C_BUS}/of_node/clock-frequency"
+        with open(path, "rb") as f:
+            return int.from_bytes(f.read(4), "big")
+    except OSError:
+        return None
+
+
+def bench_burst(bus, length, duration):
+    # Écriture du pointeur puis lecture en rafale (repeated start), sans
+    # toucher au bitmap ni à la FIFO qui sont vidés par la lecture
+    count = 0
+    start = time.perf_counter()
+    end = start + duration
+    while time.perf_counter() < end:
+        write = i2c_msg.write(I2C_SLAVE_ADDR, [REG_STATUS])
+        read = i2c_msg.read(I2C_SLAVE_ADDR, length)
+        bus.i2c_rdwr(write, read)
+        count += 1
+    return count, time.perf_counter() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Débit I2C des lectures de registres en rafale")
+    parser.add_argument("-t", "--duration", type=float, default=2.0,
+                        help="durée de chaque mesure en secondes")
+    args = parser.parse_args()
+
+    freq = bus_frequency()
+    print(f"Bus I2C {I2C_BUS} : {freq // 1000 if freq else '?'} kHz")
+    print(f"{'octets':>6} {'trans/s':>9} {'octets/s':>9} {'bus/s':>9}")
+
+    with SMBus(I2C_BUS) as bus:
+        for length in BURST_SIZES:
+            count, elapsed = bench_burst(bus, length, args.duration)
+            transactions = count / elapsed
+            # Octets utiles, puis octets sur le fil : adresse + pointeur,
+            # adresse + données
+            print(f"{length:6d} {transactions:9.0f} {transactions * length:9.0f} "
+                  f"{transactions * (length + 3):9.0f}")
+
+        # Pire durée de l'interruption TWI (firmware compilé avec I2C_ISR_PROFILING)
+        isr_time = bus.read_byte_data(I2C_SLAVE_ADDR, REG_ISR_TIME)
+        if isr_time:
+            print(f"Interruption TWI : {isr_time * 4} us au pire")
+
+
+if __name__ == "__main__":
+    main()
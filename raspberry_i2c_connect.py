@@ -1,37 +1,192 @@
-from smbus2 import SMBus
+from smbus2 import SMBus, i2c_msg
+import RPi.GPIO as GPIO
+import os
 import time
 
+# Registres de l'Arduino, générés par `make i2c_registers.py`
+from i2c_registers import *
+
 I2C_SLAVE_ADDR = 0x32
 
+# Badges autorisés à désarmer l'alarme, synchronisés au démarrage
+BADGES_FILE = "badges.txt"
+
+# Liste des badges côté Arduino (allow_list.h) et statuts des trames (i2c.h)
+ALLOWLIST_MAX = 64
+ALLOWLIST_BEGIN = 0x01
+ALLOWLIST_ADD = 0x02
+ALLOWLIST_COMMIT = 0x03
+CMD_OK = 0x00
+
+# Ligne d'attention de l'Arduino (D9, open-drain actif bas)
+ATTN_GPIO = 17
+
+EVENT_NAMES = {
+    0x01: "MOTION_START",
+    0x02: "MOTION_STOP",
+    0x03: "TAG_READ",
+    0x04: "BUTTON_PRESS",
+    0x05: "ALARM_CHANGE",
+    0x06: "PRESENCE",
+}
+
+
+def read_burst(bus, reg, length):
+    # Écriture du pointeur puis lecture en une seule transaction (repeated start)
+    write = i2c_msg.write(I2C_SLAVE_ADDR, [reg])
+    read = i2c_msg.read(I2C_SLAVE_ADDR, length)
+    bus.i2c_rdwr(write, read)
+    return list(read)
+
+
+def crc8(data):
+    # CRC-8 polynôme 0x07, valeur initiale 0 (_crc8_ccitt_update côté Arduino)
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def send_frame(bus, seq, operations):
+    # Plusieurs commandes (registre, valeur) en une seule écriture, sans
+    # relecture : l'acquittement arrive dans REG_CMD_ACK / REG_CMD_NACK
+    frame = [seq & 0xFF, len(operations)]
+    for reg, value in operations:
+        frame += [reg, value]
+    frame.append(crc8(frame))
+    bus.i2c_rdwr(i2c_msg.write(I2C_SLAVE_ADDR, [REG_MAILBOX] + frame))
+
+
+def send_data_frame(bus, seq, reg, payload):
+    # Bloc de données pour le firmware (liste des badges...), statut dans
+    # REG_CMD_ACK / REG_CMD_NACK comme les commandes
+    frame = [seq & 0xFF, 0x80 | len(payload), reg] + list(payload)
+    frame.append(crc8(frame))
+    bus.i2c_rdwr(i2c_msg.write(I2C_SLAVE_ADDR, [REG_MAILBOX] + frame))
+
+
+def wait_ack(bus, seq, timeout=0.5):
+    # Les trames sont traitées dans l'ordre : REG_CMD_ACK passe à seq une
+    # fois la trame n°seq traitée, avec son statut
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        ack = decode(read_burst(bus, REG_CMD_ACK, 2), REG_CMD_ACK, REG_CMD_ACK)
+        if ack >> 8 == seq & 0xFF:
+            return ack & 0xFF
+        time.sleep(0.01)
+    return None
+
+
+def sync_allowlist(bus, seq, badges, attempts=3):
+    # Badges autorisés à désarmer sans le Raspberry Pi : l'identifiant
+    # complet de REG_RFID_CARD (10 chiffres hexadécimaux, 5 octets),
+    # envoyés triés, deux par trame
+    keys = sorted({bytes.fromhex(badge) for badge in badges})
+    if any(len(key) != REGISTERS[REG_RFID_CARD][1] for key in keys):
+        raise ValueError("badge : 10 chiffres hexadécimaux attendus")
+    if len(keys) > ALLOWLIST_MAX:
+        raise ValueError(f"{len(keys)} badges, {ALLOWLIST_MAX} au plus")
+
+    frames = [[ALLOWLIST_BEGIN]]
+    frames += [[ALLOWLIST_ADD] + list(b"".join(keys[i:i + 2])) for i in range(0, len(keys), 2)]
+    frames += [[ALLOWLIST_COMMIT]]
+
+    # ALLOWLIST_BEGIN vide la liste : après un refus, tout est renvoyé
+    for _ in range(attempts):
+        for payload in frames:
+            send_data_frame(bus, seq, REG_ALLOWLIST, payload)
+            status = wait_ack(bus, seq)  # Écriture EEPROM comprise
+            seq += 1
+            if status != CMD_OK:
+                status = "pas de réponse" if status is None else f"statut {status}"
+                break
+        else:
+            count = read_burst(bus, REG_ALLOWLIST, 1)[0]
+            if count == len(keys):
+                return seq
+            status = f"{count} badges enregistrés"
+        print(f"Synchronisation des badges : échec ({status}), nouvel essai")
+        time.sleep(0.1)
+    raise RuntimeError("synchronisation des badges impossible")
+
+
+def load_badges(path):
+    # Un identifiant par ligne, lignes vides et commentaires (#) ignorés
+    with open(path) as f:
+        return [line.split("#")[0].strip() for line in f if line.split("#")[0].strip()]
+
+
+def drain_events(bus):
+    data = read_burst(bus, REG_EVENT_FIFO, 32)
+    for i in range(0, len(data), 4):
+        event_type, value, ts_h, ts_l = data[i:i + 4]
+        if event_type == 0x00:  # EVENT_NONE : plus rien en attente
+            break
+        name = EVENT_NAMES.get(event_type, hex(event_type))
+        print(f"[{(ts_h << 8) | ts_l:5d} ms] {name} ({value})")
+
+
+def read_changed(bus, registers):
+    # Bitmap des registres modifiés (lu et remis à zéro par l'Arduino)
+    bitmap = read_burst(bus, REG_DIRTY, REGISTERS[REG_DIRTY][1])
+    dirty = int.from_bytes(bytes(bitmap), "little")
+
+    # Une lecture en rafale par plage de registres modifiés consécutifs
+    reg = 0
+    while reg < REG_DIRTY:
+        if dirty & (1 << reg):
+            end = reg
+            while end < REG_DIRTY and dirty & (1 << end):
+                end += 1
+            registers[reg:end] = read_burst(bus, reg, end - reg)
+            reg = end
+        else:
+            reg += 1
 
-# Registres (doivent correspondre à ceux de l'Arduino)
-REG_SENSOR = 0x01
-REG_ACTUATOR = 0x02
 
 def main():
+    GPIO.setmode(GPIO.BCM)
+    GPIO.setup(ATTN_GPIO, GPIO.IN, pull_up_down=GPIO.PUD_UP)
+
     with SMBus(1) as bus: # Bus 1 est le standard sur RPi
-        while True:
-            try:
-                # 1. ÉCRIRE : Envoyer une commande (Allumer actionneur = 1)
-                print("Envoi commande ON...")
-                bus.write_byte_data(I2C_SLAVE_ADDR, REG_ACTUATOR, 1)
-                time.sleep(3)
-                
-                # 2. LIRE : Demander la valeur du capteur
-                # write_byte (pour placer le pointeur) puis read_byte n'est pas atomique
-                # read_byte_data fait les deux automatiquement
-                """valeur = bus.read_byte_data(I2C_SLAVE_ADDR, REG_SENSOR)
-                print(f"Valeur capteur reçue : {valeur}")"""
-
-                # 3. ÉCRIRE : Envoyer commande OFF
-                print("Envoi commande OFF...")
-                bus.write_byte_data(I2C_SLAVE_ADDR, REG_ACTUATOR, 0)
-                
-                time.sleep(0.25)
-
-            except Exception as e:
-                print(f"Erreur I2C : {e}")
-                time.sleep(1)
+        # Lecture initiale de toute la banque, ensuite seulement les deltas
+        registers = read_burst(bus, REG_STATUS, NUM_REGISTERS)
+        try:
+            # Numérotation reprise après la dernière trame traitée par l'Arduino
+            seq = (decode(registers, REG_CMD_ACK) >> 8) + 1
+            if os.path.exists(BADGES_FILE):
+                seq = sync_allowlist(bus, seq, load_badges(BADGES_FILE))
+                print(f"Badges synchronisés : {read_burst(bus, REG_ALLOWLIST, 1)[0]}")
+
+            while True:
+                try:
+                    # Aucun trafic I2C tant que l'Arduino n'a rien à signaler
+                    if GPIO.input(ATTN_GPIO):
+                        GPIO.wait_for_edge(ATTN_GPIO, GPIO.FALLING)
+
+                    drain_events(bus)
+
+                    read_changed(bus, registers)
+                    print(f"Alarme : {registers[REG_ALARM_STATE]}, "
+                          f"distance : {decode(registers, REG_DISTANCE)} mm, "
+                          f"présence : {registers[REG_PRESENCE]:04b}")
+                    if registers[REG_RFID_STATUS]:
+                        card = decode(registers, REG_RFID_CARD)
+                        print(f"Badge : {card:010X}")
+
+                    # Trame de commandes n°seq traitée (octet de poids faible : statut)
+                    ack = decode(registers, REG_CMD_ACK)
+                    nack = decode(registers, REG_CMD_NACK)
+                    print(f"Commandes : dernière trame {ack >> 8} (statut {ack & 0xFF}), "
+                          f"dernier rejet {nack >> 8} (statut {nack & 0xFF})")
+
+                except Exception as e:
+                    print(f"Erreur I2C : {e}")
+                    time.sleep(1)
+        finally:
+            GPIO.cleanup()
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    main()
@@ -0,0 +1,67 @@
+from smbus2 import SMBus, i2c_msg
+import argparse
+import time
+
+# Registres de l'Arduino, générés par `make i2c_registers.py`
+from i2c_registers import REG_HISTORY, REG_HISTORY_SOURCE
+
+I2C_SLAVE_ADDR = 0x32
+I2C_BUS = 1
+
+# En-tête puis échantillons (DISTANCE_HISTORY_SIZE côté Arduino)
+HEADER_SIZE = 8
+HISTORY_SIZE = 64
+LONG_FLAG = 0x80
+
+
+def read_history(bus):
+    # Une seule lecture en rafale : l'Arduino retire les échantillons envoyés
+    write = i2c_msg.write(I2C_SLAVE_ADDR, [REG_HISTORY])
+    read = i2c_msg.read(I2C_SLAVE_ADDR, HEADER_SIZE + HISTORY_SIZE)
+    bus.i2c_rdwr(write, read)
+    data = bytes(read)
+
+    count, lost = data[0], data[1]
+    t = int.from_bytes(data[2:6], "big")
+    distance = int.from_bytes(data[6:8], "big")
+
+    # Chaque échantillon est relatif au précédent (l'en-tête pour le premier)
+    samples = []
+    body = data[HEADER_SIZE:HEADER_SIZE + count]
+    i = 0
+    while i + 2 <= len(body):
+        if body[i] & LONG_FLAG:
+            if i + 4 > len(body):
+                break
+            t += ((body[i] & ~LONG_FLAG) << 8) | body[i + 1]
+            distance = (body[i + 2] << 8) | body[i + 3]
+            i += 4
+        else:
+            t += body[i] * 4
+            distance += int.from_bytes(body[i + 1:i + 2], "big", signed=True)
+            i += 2
+        samples.append((t, distance))
+    return samples, lost
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Trace brute d'un télémètre à ultrasons (CSV)")
+    parser.add_argument("-s", "--sensor", type=int, default=0, help="télémètre enregistré")
+    parser.add_argument("-i", "--interval", type=float, default=1.0,
+                        help="secondes entre deux lectures (moins que la durée du tampon)")
+    args = parser.parse_args()
+
+    with SMBus(I2C_BUS) as bus:
+        bus.write_byte_data(I2C_SLAVE_ADDR, REG_HISTORY_SOURCE, args.sensor)
+        print("temps_ms,distance_mm")
+        while True:
+            samples, lost = read_history(bus)
+            if lost:
+                print(f"# {lost} échantillons perdus")
+            for t, distance in samples:
+                print(f"{t},{distance}")
+            time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
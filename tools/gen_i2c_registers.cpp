@@ -0,0 +1,48 @@
+/*
+    Host tool: prints the Python register module of the Raspberry Pi side
+    from I2C_REGISTER_TABLE, see `make i2c_registers.py`
+*/
+
+#include <stdio.h>
+#include "drivers/i2c/i2c_registers.h"
+
+static const char *accessName(uint8_t access)
+{
+    switch (access)
+    {
+    case I2C_RW:
+        return "rw";
+    case I2C_RC:
+        return "rc";
+    case I2C_WO:
+        return "wo";
+    default:
+        return "ro";
+    }
+}
+
+int main()
+{
+    printf("# Generated from drivers/i2c/i2c_registers.h by `make i2c_registers.py`, do not edit\n\n");
+    printf("NUM_REGISTERS = %d\n\n", I2C_NUM_REGISTERS);
+
+#define I2C_REGISTER_CONSTANT(name, offset, width, access, description) \
+    printf("REG_%-16s = 0x%02X  # %s\n", #name, (offset), description);
+    I2C_REGISTER_TABLE(I2C_REGISTER_CONSTANT)
+#undef I2C_REGISTER_CONSTANT
+
+    printf("\n# Offset -> (name, width in bytes, master access)\n");
+    printf("REGISTERS = {\n");
+#define I2C_REGISTER_ENTRY(name, offset, width, access, description) \
+    printf("    0x%02X: (\"%s\", %d, \"%s\"),\n", (offset), #name, (width), accessName(access));
+    I2C_REGISTER_TABLE(I2C_REGISTER_ENTRY)
+#undef I2C_REGISTER_ENTRY
+    printf("}\n\n\n");
+
+    printf("def decode(bank, reg, base=0):\n");
+    printf("    \"\"\"Value of register reg out of bytes read from offset base on\n");
+    printf("    (multi-byte registers are big-endian)\"\"\"\n");
+    printf("    width = REGISTERS[reg][1]\n");
+    printf("    return int.from_bytes(bytes(bank[reg - base:reg - base + width]), \"big\")\n");
+    return 0;
+}